@@ -0,0 +1,283 @@
+//
+// Copyright (c) 2025 Fas Xmut (fasxmut at protonmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// A localhost HTTPS server for measuring uget, on the same Botan/asio
+// stack. It makes its own CA and a "localhost" certificate at startup and
+// writes the CA to a PEM file that `uget --ca-file` can trust.
+//
+//	GET /                          --size bytes after --latency ms
+//	GET /bytes/<n>                 n bytes
+//	GET /bytes/<n>?delay=<ms>      n bytes after ms
+//
+// HEAD gets the headers of the same response, any other method 405.
+
+#include <iostream>
+#include <botan/asio_stream.h>
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+#include <string_view>
+#include <botan/auto_rng.h>
+#include <botan/tls.h>
+#include <fstream>
+#include <charconv>
+#include <thread>
+#include <vector>
+#include <lyra/lyra.hpp>
+#include "uget-server.hpp"
+
+const std::string program_name = "uget-bench-server";
+
+using std::string_literals::operator""s;
+
+namespace bench
+{
+	struct settings
+	{
+		std::uint64_t size = 16 * 1024;
+		std::chrono::milliseconds latency{0};
+	};
+
+	class session: virtual public std::enable_shared_from_this<bench::session>
+	{
+	private:
+		static constexpr std::size_t block_size = 64 * 1024;
+	private:
+		Botan::TLS::Stream<boost::beast::tcp_stream> __tls_stream;
+		const bench::settings & __settings;
+	public:
+		session(
+			boost::asio::ip::tcp::socket socket__,
+			std::shared_ptr<Botan::TLS::Context> context__,
+			const bench::settings & settings__
+		):
+			__tls_stream{context__, std::move(socket__)},
+			__settings{settings__}
+		{
+		}
+	public:
+		boost::asio::awaitable<void> run()
+		{
+			auto self = this->shared_from_this();
+			co_await uget::server::serve_tls(
+				__tls_stream,
+				[this] (const uget::server::request_type & request__)
+				{
+					return this->respond(request__);
+				}
+			);
+		}
+	private:
+		boost::asio::awaitable<bool> respond(const uget::server::request_type & request__)
+		{
+			if (request__.method() != boost::beast::http::verb::get && request__.method() != boost::beast::http::verb::head)
+				co_return co_await this->not_allowed(request__);
+
+			auto size = __settings.size;
+			auto delay = __settings.latency;
+			parse_target(request__.target(), size, delay);
+
+			if (delay.count() != 0)
+			{
+				boost::asio::steady_timer timer{co_await boost::asio::this_coro::executor};
+				timer.expires_after(delay);
+				co_await timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+			}
+
+			static const std::string block(block_size, 'x');
+
+			boost::beast::http::response<boost::beast::http::buffer_body> response{
+				boost::beast::http::status::ok,
+				request__.version()
+			};
+			response.set(boost::beast::http::field::server, program_name);
+			response.set(boost::beast::http::field::content_type, "application/octet-stream");
+			response.keep_alive(request__.keep_alive());
+			response.content_length(size);
+			// HEAD gets the length of what GET would send, and nothing else
+			if (request__.method() == boost::beast::http::verb::head)
+				size = 0;
+			response.body().data = nullptr;
+			response.body().more = size != 0;
+
+			boost::beast::http::response_serializer<boost::beast::http::buffer_body> serializer{response};
+			__tls_stream.next_layer().expires_after(std::chrono::seconds(30));
+			auto [ec, bytes] = co_await boost::beast::http::async_write_header(
+				__tls_stream,
+				serializer,
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			if (ec)
+				co_return false;
+
+			while (size != 0)
+			{
+				auto n = std::min<std::uint64_t>(size, block_size);
+				size -= n;
+				response.body().data = const_cast<char *>(block.data());
+				response.body().size = n;
+				response.body().more = size != 0;
+
+				__tls_stream.next_layer().expires_after(std::chrono::seconds(30));
+				auto [ec, bytes] = co_await boost::beast::http::async_write(
+					__tls_stream,
+					serializer,
+					boost::asio::as_tuple(boost::asio::use_awaitable)
+				);
+				if (ec == boost::beast::http::error::need_buffer)
+					ec = {};
+				if (ec)
+					co_return false;
+			}
+			co_return true;
+		}
+		boost::asio::awaitable<bool> not_allowed(const uget::server::request_type & request__)
+		{
+			boost::beast::http::response<boost::beast::http::string_body> response{
+				boost::beast::http::status::method_not_allowed,
+				request__.version()
+			};
+			response.set(boost::beast::http::field::server, program_name);
+			response.set(boost::beast::http::field::allow, "GET, HEAD");
+			response.set(boost::beast::http::field::content_type, "text/plain");
+			response.keep_alive(request__.keep_alive());
+			response.body() = "Method Not Allowed\n";
+			response.prepare_payload();
+
+			__tls_stream.next_layer().expires_after(std::chrono::seconds(30));
+			auto [ec, bytes] = co_await boost::beast::http::async_write(
+				__tls_stream,
+				response,
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			co_return ! ec;
+		}
+		// /bytes/<n>[?delay=<ms>]
+		static void parse_target(
+			std::string_view target__,
+			std::uint64_t & size__,
+			std::chrono::milliseconds & delay__
+		)
+		{
+			constexpr std::string_view prefix = "/bytes/";
+			if (! target__.starts_with(prefix))
+				return;
+			// --latency is for / only
+			delay__ = std::chrono::milliseconds(0);
+			target__.remove_prefix(prefix.size());
+			auto query = target__.find('?');
+			auto path = target__.substr(0, query);
+			std::from_chars(path.data(), path.data() + path.size(), size__);
+
+			if (query == std::string_view::npos)
+				return;
+			auto params = target__.substr(query + 1);
+			constexpr std::string_view key = "delay=";
+			if (auto at = params.find(key); at != std::string_view::npos)
+			{
+				auto value = params.substr(at + key.size());
+				long ms = 0;
+				std::from_chars(value.data(), value.data() + value.size(), ms);
+				delay__ = std::chrono::milliseconds(ms);
+			}
+		}
+	};
+
+	boost::asio::awaitable<void> listen(
+		boost::asio::ip::tcp::acceptor & acceptor__,
+		std::shared_ptr<Botan::TLS::Context> context__,
+		const bench::settings & settings__
+	)
+	{
+		co_await uget::server::accept_loop(
+			acceptor__,
+			[&context__, &settings__] (boost::asio::ip::tcp::socket socket__)
+			{
+				auto executor = socket__.get_executor();
+				auto session = std::make_shared<bench::session>(std::move(socket__), context__, settings__);
+				boost::asio::co_spawn(executor, session->run(), boost::asio::detached);
+			}
+		);
+	}
+}	// namespace bench
+
+int main(int argc, char * argv[])
+try
+{
+	bool help = false;
+	std::string address = "127.0.0.1";
+	unsigned short port = 8443;
+	std::string ca_file = "uget-bench-ca.pem";
+	std::uint64_t size = 16 * 1024;
+	long latency = 0;
+	unsigned threads = 1;
+
+	auto cli = lyra::help(help)
+		| lyra::opt(address, "address")["-a"]["--address"]("listen address (default 127.0.0.1)")
+		| lyra::opt(port, "port")["-p"]["--port"]("listen port (default 8443)")
+		| lyra::opt(ca_file, "file")["--ca-out"]("where to write the CA certificate (default uget-bench-ca.pem)")
+		| lyra::opt(size, "bytes")["--size"]("payload size for / (default 16384)")
+		| lyra::opt(latency, "ms")["--latency"]("delay before every response to / (default 0)")
+		| lyra::opt(threads, "n")["--threads"]("io_context threads (default 1)")
+	;
+	auto parsed = cli.parse({argc, argv});
+	if (help || ! parsed)
+	{
+		std::clog << cli << std::endl;
+		if (help)
+			return 0;
+		throw std::runtime_error{"arguments error: "s + parsed.message()};
+	}
+
+	bench::settings settings{size, std::chrono::milliseconds(latency)};
+
+	auto rng = std::make_shared<Botan::AutoSeeded_RNG>();
+	uget::server::throwaway_ca ca{"uget bench CA", * rng};
+	auto key = uget::server::throwaway_ca::make_key(* rng);
+	auto credentials = std::make_shared<uget::server::chain_credentials>(
+		std::vector<Botan::X509_Certificate>{ca.issue({"localhost"}, * key), ca.cert()},
+		key
+	);
+	{
+		std::ofstream out{ca_file};
+		out << ca.cert().PEM_encode();
+		if (! out)
+			throw std::runtime_error{"can not write " + ca_file};
+	}
+	auto context = std::make_shared<Botan::TLS::Context>(
+		credentials,
+		rng,
+		std::make_shared<Botan::TLS::Session_Manager_In_Memory>(rng),
+		std::make_shared<Botan::TLS::Policy>()
+	);
+
+	boost::asio::io_context io_context{static_cast<int>(threads)};
+	boost::asio::ip::tcp::acceptor acceptor{
+		io_context,
+		{boost::asio::ip::make_address(address), port}
+	};
+	boost::asio::co_spawn(
+		io_context,
+		bench::listen(acceptor, context, settings),
+		boost::asio::detached
+	);
+
+	std::clog << program_name << ": https://localhost:" << port << "/ , CA in " << ca_file
+		<< ", " << size << " bytes, " << latency << "ms latency" << std::endl;
+
+	std::vector<std::jthread> pool;
+	for (unsigned i = 1; i < threads; ++i)
+		pool.emplace_back([&io_context] { io_context.run(); });
+	io_context.run();
+
+	return 0;
+}
+catch (std::exception & e)
+{
+	std::cerr << "\n\n\n";
+	std::cerr << "Caught std::exception:\n" << e.what() << std::endl << std::endl;
+	return 1;
+}
@@ -0,0 +1,806 @@
+//
+// Copyright (c) 2025 Fas Xmut (fasxmut at protonmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// A static file HTTPS server on the same Botan/asio stack as uget: the
+// mirror side of it, for artifacts and as a local stand-in for client
+// benchmarks.
+//
+//	GET, HEAD        files under --root, index.html for a directory
+//	Range            one byte range, 206 or 416; several get the whole file
+//	If-None-Match    304 on a matching ETag; If-Range falls back to 200
+//	Accept-Encoding  a fresh <file>.gz next to the file is sent as is
+//
+// Hot files are kept in memory, least recently used dropped first once
+// they add up to more than --cache MiB; a file over a quarter of that is
+// not kept. The copy is read once with pread instead of mapped: a file
+// truncated under a mapping takes the server down with SIGBUS. Other
+// files are read with pread into a buffer per connection, and one
+// truncated while it is sent only cuts that response short. A response
+// keeps its copy or its open file after the cache has dropped it. A
+// file rewritten in place while it is read can go out half old, half
+// new: replace files by rename.
+//
+// With --cert and --key it serves that chain; without, it makes a
+// throwaway CA and a certificate for localhost and every --name, and
+// writes the CA to a PEM file that `uget --ca-file` can trust.
+
+#include <iostream>
+#include <botan/asio_stream.h>
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+#include <string_view>
+#include <botan/auto_rng.h>
+#include <botan/tls.h>
+#include <botan/data_src.h>
+#include <botan/pkcs8.h>
+#include <filesystem>
+#include <fstream>
+#include <charconv>
+#include <thread>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <syncstream>
+#include <ctime>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <lyra/lyra.hpp>
+#include "uget-server.hpp"
+
+const std::string program_name = "uget-serve";
+
+using std::string_literals::operator""s;
+
+namespace serve
+{
+	// --cert and --key: the leaf first, then its intermediates
+	std::shared_ptr<uget::server::chain_credentials> load_credentials(
+		const std::filesystem::path & cert__,
+		const std::filesystem::path & key__
+	)
+	{
+		std::vector<Botan::X509_Certificate> chain;
+		Botan::DataSource_Stream in{cert__.string()};
+		while (! in.end_of_data())
+		{
+			try
+			{
+				chain.emplace_back(in);
+			}
+			catch (const Botan::Decoding_Error &)
+			{
+				break;
+			}
+		}
+		if (chain.empty())
+			throw std::runtime_error{"no certificate in " + cert__.string()};
+		Botan::DataSource_Stream key{key__.string()};
+		return std::make_shared<uget::server::chain_credentials>(std::move(chain), Botan::PKCS8::load_key(key));
+	}
+
+	// An open file, with what it was opened from: a cached one is good
+	// while the path still has the same inode, size and mtime. Once
+	// load()ed, it is a copy in memory and the descriptor is closed.
+	class open_file
+	{
+	private:
+		int __fd;
+		std::uint64_t __size;
+		::ino_t __inode;
+		std::timespec __mtime;
+		std::unique_ptr<char[]> __data;
+	public:
+		open_file(const std::filesystem::path & path__, const struct ::stat & st__):
+			__fd{::open(path__.c_str(), O_RDONLY | O_CLOEXEC)},
+			__size{static_cast<std::uint64_t>(st__.st_size)},
+			__inode{st__.st_ino},
+			__mtime{st__.st_mtim},
+			__data{}
+		{
+			if (__fd < 0)
+				throw std::system_error{errno, std::generic_category(), "open " + path__.string()};
+			::posix_fadvise(__fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+		open_file(const open_file &) = delete;
+		open_file & operator=(const open_file &) = delete;
+		~open_file()
+		{
+			if (__fd >= 0)
+				::close(__fd);
+		}
+	public:
+		// up to size__ bytes at offset__, from the copy or read into buffer__;
+		// fewer, down to none, once the file has been cut shorter than it
+		// was when opened
+		std::string_view read(std::uint64_t offset__, char * buffer__, std::size_t size__) const
+		{
+			if (__data)
+				return {__data.get() + offset__, static_cast<std::size_t>(std::min<std::uint64_t>(size__, __size - offset__))};
+			for (;;)
+			{
+				auto got = ::pread(__fd, buffer__, size__, static_cast<::off_t>(offset__));
+				if (got >= 0)
+					return {buffer__, static_cast<std::size_t>(got)};
+				if (errno != EINTR)
+					throw std::system_error{errno, std::generic_category(), "pread"};
+			}
+		}
+		// the whole file into memory; false, and still open, when it is no
+		// longer as long as it was
+		bool load()
+		{
+			auto data = std::make_unique_for_overwrite<char[]>(__size);
+			for (std::uint64_t offset = 0; offset != __size;)
+			{
+				auto got = this->read(offset, data.get() + offset, static_cast<std::size_t>(__size - offset));
+				if (got.empty())
+					return false;
+				offset += got.size();
+			}
+			__data = std::move(data);
+			::close(__fd);
+			__fd = -1;
+			return true;
+		}
+		std::uint64_t size() const
+		{
+			return __size;
+		}
+		bool current(const struct ::stat & st__) const
+		{
+			return __inode == st__.st_ino
+				&& __size == static_cast<std::uint64_t>(st__.st_size)
+				&& __mtime.tv_sec == st__.st_mtim.tv_sec
+				&& __mtime.tv_nsec == st__.st_mtim.tv_nsec;
+		}
+		// "<size>-<mtime ns>" in hex, quoted
+		std::string etag(std::string_view suffix__ = {}) const
+		{
+			auto ns = static_cast<std::uint64_t>(__mtime.tv_sec) * 1000000000 + static_cast<std::uint64_t>(__mtime.tv_nsec);
+			char buffer[40];
+			auto end = std::to_chars(buffer, buffer + 20, __size, 16).ptr;
+			* end++ = '-';
+			end = std::to_chars(end, buffer + sizeof buffer, ns, 16).ptr;
+			return '"' + std::string{buffer, end} + std::string{suffix__} + '"';
+		}
+		// IMF-fixdate
+		std::string last_modified() const
+		{
+			std::tm tm{};
+			::gmtime_r(& __mtime.tv_sec, & tm);
+			char buffer[64];
+			auto size = std::strftime(buffer, sizeof buffer, "%a, %d %b %Y %H:%M:%S GMT", & tm);
+			return {buffer, size};
+		}
+	};
+
+	// Recently served files in memory, most recent first, at most
+	// __budget bytes of them. Shared by every connection, so it locks.
+	class file_cache
+	{
+	private:
+		struct entry
+		{
+			std::shared_ptr<const serve::open_file> file;
+			std::list<std::string>::iterator order;
+		};
+	private:
+		std::mutex __mutex;
+		std::list<std::string> __order;
+		std::map<std::string, entry, std::less<>> __entries;
+		std::uint64_t __budget;
+		std::uint64_t __size;
+	public:
+		explicit file_cache(std::uint64_t budget__):
+			__mutex{},
+			__order{},
+			__entries{},
+			__budget{budget__},
+			__size{0}
+		{
+		}
+	public:
+		// st__ is what the caller just got from stat(path__)
+		std::shared_ptr<const serve::open_file> open(const std::filesystem::path & path__, const struct ::stat & st__)
+		{
+			const auto & key = path__.native();
+			{
+				std::lock_guard lock{__mutex};
+				if (auto it = __entries.find(key); it != __entries.end())
+				{
+					if (it->second.file->current(st__))
+					{
+						__order.splice(__order.begin(), __order, it->second.order);
+						return it->second.file;
+					}
+					this->erase(it);
+				}
+			}
+
+			// read outside the lock, a second request for it may read it too;
+			// a large file would push out everything else, it is not kept
+			auto file = std::make_shared<serve::open_file>(path__, st__);
+			if (file->size() > __budget / 4 || ! file->load())
+				return file;
+
+			std::lock_guard lock{__mutex};
+			if (auto it = __entries.find(key); it != __entries.end())
+				this->erase(it);
+			__order.push_front(key);
+			__entries.emplace(key, entry{file, __order.begin()});
+			__size += file->size();
+			while (__size > __budget)
+				this->erase(__entries.find(__order.back()));
+			return file;
+		}
+	private:
+		void erase(std::map<std::string, entry, std::less<>>::iterator it__)
+		{
+			__size -= it__->second.file->size();
+			__order.erase(it__->second.order);
+			__entries.erase(it__);
+		}
+	};
+
+	struct settings
+	{
+		std::filesystem::path root;
+		bool access_log = false;
+	};
+
+	// What a GET for one target resolves to; a directory is its index.html.
+	struct resource
+	{
+		std::filesystem::path path;
+		struct ::stat st{};
+		std::string_view content_type;
+		bool directory = false;
+	};
+
+	class session: virtual public std::enable_shared_from_this<serve::session>
+	{
+	private:
+		// bytes handed to a TLS write at a time
+		static constexpr std::size_t block_size = 64 * 1024;
+	private:
+		using request_type = uget::server::request_type;
+		using status = boost::beast::http::status;
+		using field = boost::beast::http::field;
+	private:
+		Botan::TLS::Stream<boost::beast::tcp_stream> __tls_stream;
+		// file data on its way into TLS, reused by every response
+		std::unique_ptr<char[]> __block;
+		const serve::settings & __settings;
+		serve::file_cache & __cache;
+	public:
+		session(
+			boost::asio::ip::tcp::socket socket__,
+			std::shared_ptr<Botan::TLS::Context> context__,
+			const serve::settings & settings__,
+			serve::file_cache & cache__
+		):
+			__tls_stream{context__, std::move(socket__)},
+			__block{std::make_unique_for_overwrite<char[]>(block_size)},
+			__settings{settings__},
+			__cache{cache__}
+		{
+		}
+	public:
+		boost::asio::awaitable<void> run()
+		{
+			auto self = this->shared_from_this();
+			co_await uget::server::serve_tls(
+				__tls_stream,
+				[this] (const request_type & request__)
+				{
+					return this->respond(request__);
+				}
+			);
+		}
+	private:
+		boost::asio::awaitable<bool> respond(const request_type & request__)
+		{
+			if (request__.method() != boost::beast::http::verb::get && request__.method() != boost::beast::http::verb::head)
+				co_return co_await this->reply(request__, status::method_not_allowed, {{field::allow, "GET, HEAD"}});
+
+			auto path = this->path(request__.target());
+			if (! path)
+				co_return co_await this->reply(request__, status::bad_request);
+			auto found = this->find(* path);
+			if (! found)
+				co_return co_await this->reply(request__, status::not_found);
+			if (auto target = std::string{request__.target()}; found->directory && ! target.substr(0, target.find('?')).ends_with('/'))
+			{
+				// relative links in the index resolve against the directory
+				target.insert(target.find('?') == std::string::npos ? target.size() : target.find('?'), 1, '/');
+				co_return co_await this->reply(request__, status::moved_permanently, {{field::location, target}});
+			}
+
+			// the precompressed sibling when the client takes gzip and it is not stale
+			bool has_gzip = false;
+			bool gzip = false;
+			auto resource = * found;
+			if (auto sibling = this->find(found->path.string() + ".gz"); sibling && ! sibling->directory)
+			{
+				auto newer = sibling->st.st_mtim.tv_sec > found->st.st_mtim.tv_sec
+					|| (sibling->st.st_mtim.tv_sec == found->st.st_mtim.tv_sec && sibling->st.st_mtim.tv_nsec >= found->st.st_mtim.tv_nsec);
+				has_gzip = newer;
+				if (newer && accepts_gzip(request__[field::accept_encoding]))
+				{
+					resource.path = sibling->path;
+					resource.st = sibling->st;
+					gzip = true;
+				}
+			}
+
+			std::shared_ptr<const serve::open_file> file;
+			try
+			{
+				file = __cache.open(resource.path, resource.st);
+			}
+			catch (const std::system_error &)
+			{
+				co_return co_await this->reply(request__, status::forbidden);
+			}
+			auto etag = file->etag(gzip ? "-gz" : "");
+
+			boost::beast::http::fields headers;
+			headers.set(field::content_type, found->content_type);
+			headers.set(field::etag, etag);
+			headers.set(field::last_modified, file->last_modified());
+			headers.set(field::accept_ranges, "bytes");
+			if (gzip)
+				headers.set(field::content_encoding, "gzip");
+			if (has_gzip)
+				headers.set(field::vary, "Accept-Encoding");
+
+			if (matches(request__[field::if_none_match], etag))
+				co_return co_await this->send(request__, status::not_modified, headers, file, 0, 0, false);
+
+			std::uint64_t begin = 0;
+			std::uint64_t end = file->size();
+			std::string_view range = request__[field::range];
+			// a stale If-Range asks for the whole new file
+			if (std::string_view if_range = request__[field::if_range]; ! if_range.empty() && if_range != etag)
+				range = {};
+			switch (parse_range(range, file->size(), begin, end))
+			{
+			case range_result::unsatisfiable:
+				headers.set(field::content_range, "bytes */" + std::to_string(file->size()));
+				co_return co_await this->reply(request__, status::range_not_satisfiable, {}, & headers);
+			case range_result::partial:
+				headers.set(
+					field::content_range,
+					"bytes " + std::to_string(begin) + '-' + std::to_string(end - 1) + '/' + std::to_string(file->size())
+				);
+				co_return co_await this->send(request__, status::partial_content, headers, file, begin, end, true);
+			case range_result::whole:
+				break;
+			}
+			co_return co_await this->send(request__, status::ok, headers, file, begin, end, true);
+		}
+		// [begin__, end__) of file__, block_size at a time; HEAD and 304 send
+		// the header only. A file cut short on disk ends the connection, the
+		// length has been promised.
+		boost::asio::awaitable<bool> send(
+			const request_type & request__,
+			status status__,
+			const boost::beast::http::fields & headers__,
+			std::shared_ptr<const serve::open_file> file__,
+			std::uint64_t begin__,
+			std::uint64_t end__,
+			bool with_length__
+		)
+		{
+			boost::beast::http::response<boost::beast::http::buffer_body> response{status__, request__.version()};
+			for (const auto & header: headers__)
+				response.set(header.name_string(), header.value());
+			response.set(field::server, program_name);
+			response.keep_alive(request__.keep_alive());
+			if (with_length__)
+				response.set(field::content_length, std::to_string(end__ - begin__));
+			if (request__.method() == boost::beast::http::verb::head || status__ == status::not_modified)
+				end__ = begin__;
+			response.body().data = nullptr;
+			response.body().more = begin__ != end__;
+
+			boost::beast::http::response_serializer<boost::beast::http::buffer_body> serializer{response};
+			__tls_stream.next_layer().expires_after(std::chrono::seconds(30));
+			auto [ec, bytes] = co_await boost::beast::http::async_write_header(
+				__tls_stream,
+				serializer,
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			for (auto offset = begin__; ! ec && offset != end__;)
+			{
+				std::string_view got;
+				try
+				{
+					got = file__->read(offset, __block.get(), static_cast<std::size_t>(std::min<std::uint64_t>(end__ - offset, block_size)));
+				}
+				catch (const std::system_error & e)
+				{
+					std::osyncstream{std::clog} << request__.target() << ": " << e.what() << std::endl;
+				}
+				if (got.empty())
+				{
+					std::osyncstream{std::clog} << request__.target() << ": file cut short while it was sent" << std::endl;
+					this->log(request__, status__, bytes);
+					co_return false;
+				}
+				offset += got.size();
+				response.body().data = const_cast<char *>(got.data());
+				response.body().size = got.size();
+				response.body().more = offset != end__;
+
+				__tls_stream.next_layer().expires_after(std::chrono::seconds(30));
+				std::size_t written = 0;
+				std::tie(ec, written) = co_await boost::beast::http::async_write(
+					__tls_stream,
+					serializer,
+					boost::asio::as_tuple(boost::asio::use_awaitable)
+				);
+				if (ec == boost::beast::http::error::need_buffer)
+					ec = {};
+				bytes += written;
+			}
+			this->log(request__, status__, bytes);
+			co_return ! ec;
+		}
+		// a short text body for errors and redirects
+		boost::asio::awaitable<bool> reply(
+			const request_type & request__,
+			status status__,
+			std::initializer_list<std::pair<field, std::string>> extra__ = {},
+			const boost::beast::http::fields * headers__ = nullptr
+		)
+		{
+			boost::beast::http::response<boost::beast::http::string_body> response{status__, request__.version()};
+			if (headers__)
+			{
+				for (const auto & header: * headers__)
+					response.set(header.name_string(), header.value());
+			}
+			for (const auto & [name, value]: extra__)
+				response.set(name, value);
+			response.set(field::server, program_name);
+			response.set(field::content_type, "text/plain");
+			response.keep_alive(request__.keep_alive());
+			if (request__.method() != boost::beast::http::verb::head)
+				response.body() = std::string{boost::beast::http::obsolete_reason(status__)} + '\n';
+			response.prepare_payload();
+			if (request__.method() == boost::beast::http::verb::head)
+				response.content_length(std::string{boost::beast::http::obsolete_reason(status__)}.size() + 1);
+
+			__tls_stream.next_layer().expires_after(std::chrono::seconds(30));
+			auto [ec, bytes] = co_await boost::beast::http::async_write(
+				__tls_stream,
+				response,
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			this->log(request__, status__, bytes);
+			co_return ! ec;
+		}
+		void log(const request_type & request__, status status__, std::size_t bytes__) const
+		{
+			if (! __settings.access_log)
+				return;
+			std::osyncstream{std::clog} << static_cast<unsigned>(status__) << ' ' << bytes__ << ' '
+				<< request__.method_string() << ' ' << request__.target() << std::endl;
+		}
+		// the file under the root a target names: percent-decoded, without
+		// the query; nothing for "..", NUL or a target that is not a path
+		std::optional<std::filesystem::path> path(std::string_view target__) const
+		{
+			target__ = target__.substr(0, target__.find_first_of("?#"));
+			if (! target__.starts_with('/'))
+				return std::nullopt;
+			std::string decoded;
+			decoded.reserve(target__.size());
+			for (std::size_t i = 0; i < target__.size(); ++i)
+			{
+				if (target__[i] != '%')
+				{
+					decoded += target__[i];
+					continue;
+				}
+				unsigned char c = 0;
+				if (i + 2 >= target__.size()
+					|| std::from_chars(target__.data() + i + 1, target__.data() + i + 3, c, 16).ptr != target__.data() + i + 3)
+					return std::nullopt;
+				decoded += static_cast<char>(c);
+				i += 2;
+			}
+
+			auto result = __settings.root;
+			for (std::string_view rest = decoded; ! rest.empty();)
+			{
+				auto slash = rest.find('/');
+				auto segment = rest.substr(0, slash);
+				rest = slash == std::string_view::npos ? "" : rest.substr(slash + 1);
+				if (segment.empty() || segment == ".")
+					continue;
+				if (segment == ".." || segment.find('\0') != std::string_view::npos)
+					return std::nullopt;
+				result /= segment;
+			}
+			return result;
+		}
+		// a regular file or a directory with an index.html
+		static std::optional<serve::resource> find(const std::filesystem::path & path__)
+		{
+			serve::resource result{path__};
+			if (::stat(path__.c_str(), & result.st) != 0)
+				return std::nullopt;
+			if (S_ISDIR(result.st.st_mode))
+			{
+				result.path /= "index.html";
+				result.directory = true;
+				if (::stat(result.path.c_str(), & result.st) != 0)
+					return std::nullopt;
+			}
+			if (! S_ISREG(result.st.st_mode))
+				return std::nullopt;
+			result.content_type = content_type(result.path);
+			return result;
+		}
+		static std::string_view content_type(const std::filesystem::path & path__)
+		{
+			static const std::map<std::string, std::string_view, std::less<>> types{
+				{".html", "text/html; charset=utf-8"},
+				{".htm", "text/html; charset=utf-8"},
+				{".css", "text/css"},
+				{".js", "text/javascript"},
+				{".json", "application/json"},
+				{".txt", "text/plain; charset=utf-8"},
+				{".xml", "application/xml"},
+				{".svg", "image/svg+xml"},
+				{".png", "image/png"},
+				{".jpg", "image/jpeg"},
+				{".jpeg", "image/jpeg"},
+				{".gif", "image/gif"},
+				{".webp", "image/webp"},
+				{".wasm", "application/wasm"},
+				{".pdf", "application/pdf"},
+				{".gz", "application/gzip"},
+				{".tgz", "application/gzip"},
+				{".xz", "application/x-xz"},
+				{".zst", "application/zstd"},
+				{".zip", "application/zip"},
+				{".tar", "application/x-tar"},
+			};
+			auto extension = path__.extension().string();
+			for (auto & c: extension)
+				c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+			if (auto it = types.find(extension); it != types.end())
+				return it->second;
+			return "application/octet-stream";
+		}
+		// "gzip" in the list with a q that is not 0
+		static bool accepts_gzip(std::string_view accept__)
+		{
+			while (! accept__.empty())
+			{
+				auto comma = accept__.find(',');
+				auto item = accept__.substr(0, comma);
+				accept__ = comma == std::string_view::npos ? "" : accept__.substr(comma + 1);
+
+				auto semicolon = item.find(';');
+				auto coding = trim(item.substr(0, semicolon));
+				if (! boost::beast::iequals(boost::beast::string_view{coding.data(), coding.size()}, "gzip") && coding != "*")
+					continue;
+				if (semicolon == std::string_view::npos)
+					return true;
+				auto q = trim(item.substr(semicolon + 1));
+				if (! (q.starts_with("q=0") && q.find_first_not_of("0.", 3) == std::string_view::npos))
+					return true;
+				// "*;q=0" still lets a "gzip" later in the list through
+				if (coding != "*")
+					return false;
+			}
+			return false;
+		}
+		static bool matches(std::string_view if_none_match__, std::string_view etag__)
+		{
+			if (trim(if_none_match__) == "*")
+				return true;
+			while (! if_none_match__.empty())
+			{
+				auto comma = if_none_match__.find(',');
+				auto tag = trim(if_none_match__.substr(0, comma));
+				if_none_match__ = comma == std::string_view::npos ? "" : if_none_match__.substr(comma + 1);
+				if (tag.starts_with("W/"))
+					tag.remove_prefix(2);
+				if (tag == etag__)
+					return true;
+			}
+			return false;
+		}
+		static std::string_view trim(std::string_view text__)
+		{
+			auto first = text__.find_first_not_of(" \t");
+			if (first == std::string_view::npos)
+				return {};
+			return text__.substr(first, text__.find_last_not_of(" \t") - first + 1);
+		}
+	private:
+		enum class range_result
+		{
+			whole,
+			partial,
+			unsatisfiable,
+		};
+		// one "bytes=a-b", "bytes=a-" or "bytes=-n" into [begin__, end__);
+		// anything else, several ranges included, is the whole file
+		static range_result parse_range(
+			std::string_view range__,
+			std::uint64_t size__,
+			std::uint64_t & begin__,
+			std::uint64_t & end__
+		)
+		{
+			constexpr std::string_view prefix = "bytes=";
+			range__ = trim(range__);
+			if (! range__.starts_with(prefix) || range__.find(',') != std::string_view::npos)
+				return range_result::whole;
+			range__.remove_prefix(prefix.size());
+			auto dash = range__.find('-');
+			if (dash == std::string_view::npos)
+				return range_result::whole;
+			auto first = trim(range__.substr(0, dash));
+			auto last = trim(range__.substr(dash + 1));
+
+			auto number = [] (std::string_view text, std::uint64_t & value)
+			{
+				return ! text.empty()
+					&& std::from_chars(text.data(), text.data() + text.size(), value).ptr == text.data() + text.size();
+			};
+			std::uint64_t a = 0;
+			std::uint64_t b = 0;
+			if (first.empty())
+			{
+				// the last b bytes
+				if (! number(last, b))
+					return range_result::whole;
+				if (b == 0 || size__ == 0)
+					return range_result::unsatisfiable;
+				begin__ = size__ - std::min(b, size__);
+				end__ = size__;
+				return range_result::partial;
+			}
+			if (! number(first, a))
+				return range_result::whole;
+			if (last.empty())
+				b = size__ == 0 ? 0 : size__ - 1;
+			else if (! number(last, b) || b < a)
+				return range_result::whole;
+			if (a >= size__)
+				return range_result::unsatisfiable;
+			begin__ = a;
+			end__ = std::min(b, size__ - 1) + 1;
+			return range_result::partial;
+		}
+	};
+
+	boost::asio::awaitable<void> listen(
+		boost::asio::ip::tcp::acceptor & acceptor__,
+		std::shared_ptr<Botan::TLS::Context> context__,
+		const serve::settings & settings__,
+		serve::file_cache & cache__
+	)
+	{
+		co_await uget::server::accept_loop(
+			acceptor__,
+			[&context__, &settings__, &cache__] (boost::asio::ip::tcp::socket socket__)
+			{
+				auto executor = socket__.get_executor();
+				auto session = std::make_shared<serve::session>(std::move(socket__), context__, settings__, cache__);
+				boost::asio::co_spawn(executor, session->run(), boost::asio::detached);
+			}
+		);
+	}
+}	// namespace serve
+
+int main(int argc, char * argv[])
+try
+{
+	bool help = false;
+	std::string address = "127.0.0.1";
+	unsigned short port = 8443;
+	std::string root = ".";
+	std::string cert;
+	std::string key;
+	std::vector<std::string> names;
+	std::string ca_file = "uget-serve-ca.pem";
+	std::size_t cache = 256;
+	unsigned threads = 1;
+	bool access_log = false;
+
+	auto cli = lyra::help(help)
+		| lyra::opt(address, "address")["-a"]["--address"]("listen address (default 127.0.0.1)")
+		| lyra::opt(port, "port")["-p"]["--port"]("listen port (default 8443)")
+		| lyra::opt(root, "dir")["-r"]["--root"]("directory to serve (default .)")
+		| lyra::opt(cert, "pem")["--cert"]("certificate chain, leaf first (default: a throwaway CA and certificate)")
+		| lyra::opt(key, "pem")["--key"]("private key of --cert, PKCS#8")
+		| lyra::opt(names, "name")["--name"]("without --cert: also issue the certificate for this name, repeatable")
+		| lyra::opt(ca_file, "file")["--ca-out"]("without --cert: where to write the CA certificate (default uget-serve-ca.pem)")
+		| lyra::opt(cache, "MiB")["--cache"]("keep up to this many MiB of hot files in memory, 0 for none (default 256)")
+		| lyra::opt(threads, "n")["--threads"]("io_context threads (default 1)")
+		| lyra::opt(access_log)["--access-log"]("one line per response on stderr: status, bytes, method, target")
+	;
+	auto parsed = cli.parse({argc, argv});
+	if (help || ! parsed || cert.empty() != key.empty())
+	{
+		std::clog << cli << std::endl;
+		if (help)
+			return 0;
+		throw std::runtime_error{"arguments error: "s + (parsed ? "--cert and --key go together"s : parsed.message())};
+	}
+
+	serve::settings settings{std::filesystem::canonical(root), access_log};
+	if (! std::filesystem::is_directory(settings.root))
+		throw std::runtime_error{root + " is not a directory"};
+	serve::file_cache file_cache{static_cast<std::uint64_t>(cache) * 1024 * 1024};
+
+	auto rng = std::make_shared<Botan::AutoSeeded_RNG>();
+	std::shared_ptr<uget::server::chain_credentials> credentials;
+	if (cert.empty())
+	{
+		// a throwaway CA and a certificate for localhost and every --name
+		names.insert(names.begin(), "localhost");
+		uget::server::throwaway_ca ca{"uget-serve CA", * rng};
+		auto leaf_key = uget::server::throwaway_ca::make_key(* rng);
+		credentials = std::make_shared<uget::server::chain_credentials>(
+			std::vector<Botan::X509_Certificate>{ca.issue(names, * leaf_key), ca.cert()},
+			leaf_key
+		);
+		std::ofstream out{ca_file};
+		out << ca.cert().PEM_encode();
+		if (! out)
+			throw std::runtime_error{"can not write " + ca_file};
+	}
+	else
+	{
+		credentials = serve::load_credentials(cert, key);
+	}
+	auto context = std::make_shared<Botan::TLS::Context>(
+		credentials,
+		rng,
+		std::make_shared<Botan::TLS::Session_Manager_In_Memory>(rng),
+		std::make_shared<Botan::TLS::Policy>()
+	);
+
+	boost::asio::io_context io_context{static_cast<int>(threads)};
+	boost::asio::ip::tcp::acceptor acceptor{
+		io_context,
+		{boost::asio::ip::make_address(address), port}
+	};
+	boost::asio::co_spawn(
+		io_context,
+		serve::listen(acceptor, context, settings, file_cache),
+		boost::asio::detached
+	);
+
+	std::clog << program_name << ": https://" << address << ':' << port << "/ from " << settings.root
+		<< (cert.empty() ? ", CA in " + ca_file : ""s) << ", " << cache << " MiB file cache" << std::endl;
+
+	std::vector<std::jthread> pool;
+	for (unsigned i = 1; i < threads; ++i)
+		pool.emplace_back([&io_context] { io_context.run(); });
+	io_context.run();
+
+	return 0;
+}
+catch (std::exception & e)
+{
+	std::cerr << "\n\n\n";
+	std::cerr << "Caught std::exception:\n" << e.what() << std::endl << std::endl;
+	return 1;
+}
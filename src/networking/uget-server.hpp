@@ -0,0 +1,199 @@
+//
+// Copyright (c) 2025 Fas Xmut (fasxmut at protonmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// The server side shared by uget-bench-server, uget-serve and uget
+// --replay: a throwaway CA and the certificates it signs, one chain as
+// Botan credentials, the accept loop and the keep-alive loop of a
+// connection.
+
+#pragma once
+
+#include <iostream>
+#include <botan/asio_stream.h>
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+#include <botan/tls.h>
+#include <botan/ecdsa.h>
+#include <botan/ec_group.h>
+#include <botan/x509self.h>
+#include <botan/x509_ca.h>
+#include <botan/pkcs10.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <syncstream>
+#include <vector>
+
+namespace uget::server
+{
+	// A CA made up at startup, for clients that are told to trust it, and
+	// the server certificates it signs.
+	class throwaway_ca
+	{
+	private:
+		Botan::RandomNumberGenerator & __rng;
+		Botan::ECDSA_PrivateKey __key;
+		Botan::X509_Certificate __cert;
+	public:
+		throwaway_ca(const std::string & name__, Botan::RandomNumberGenerator & rng__):
+			__rng{rng__},
+			__key{rng__, Botan::EC_Group{"secp256r1"}},
+			__cert{make_cert(name__, __key, rng__)}
+		{
+		}
+	public:
+		const Botan::X509_Certificate & cert() const
+		{
+			return __cert;
+		}
+		// a key for the certificates issue() signs
+		static std::shared_ptr<Botan::Private_Key> make_key(Botan::RandomNumberGenerator & rng__)
+		{
+			return std::make_shared<Botan::ECDSA_PrivateKey>(rng__, Botan::EC_Group{"secp256r1"});
+		}
+		// a server certificate for key__ and every one of names__, the first
+		// one its subject; good from an hour ago for 30 days
+		Botan::X509_Certificate issue(const std::vector<std::string> & names__, const Botan::Private_Key & key__)
+		{
+			Botan::X509_Cert_Options options{names__.front()};
+			for (const auto & name: names__)
+				options.more_dns.push_back(name);
+			options.add_ex_constraint("PKIX.ServerAuth");
+			auto request = Botan::X509::create_cert_req(options, key__, "SHA-256", __rng);
+
+			Botan::X509_CA ca{__cert, __key, "SHA-256", __rng};
+			auto now = std::chrono::system_clock::now();
+			return ca.sign_request(
+				request,
+				__rng,
+				Botan::X509_Time{now - std::chrono::hours(1)},
+				Botan::X509_Time{now + std::chrono::hours(24 * 30)}
+			);
+		}
+	private:
+		static Botan::X509_Certificate make_cert(
+			const std::string & name__,
+			const Botan::Private_Key & key__,
+			Botan::RandomNumberGenerator & rng__
+		)
+		{
+			Botan::X509_Cert_Options options{name__};
+			options.CA_key();
+			return Botan::X509::create_self_signed_cert(options, key__, "SHA-256", rng__);
+		}
+	};
+
+	// one certificate chain, the leaf first, and the leaf's key
+	class chain_credentials:
+		virtual public Botan::Credentials_Manager
+	{
+	private:
+		std::vector<Botan::X509_Certificate> __chain;
+		std::shared_ptr<Botan::Private_Key> __key;
+	public:
+		chain_credentials(std::vector<Botan::X509_Certificate> chain__, std::shared_ptr<Botan::Private_Key> key__):
+			__chain{std::move(chain__)},
+			__key{std::move(key__)}
+		{
+		}
+	public:
+		std::vector<Botan::X509_Certificate> cert_chain(
+			const std::vector<std::string> & cert_key_types__,
+			const std::vector<Botan::AlgorithmIdentifier> &,
+			const std::string &,
+			const std::string &
+		) override
+		{
+			for (const auto & type: cert_key_types__)
+			{
+				if (type == __key->algo_name())
+					return __chain;
+			}
+			return {};
+		}
+		std::shared_ptr<Botan::Private_Key> private_key_for(
+			const Botan::X509_Certificate & cert__,
+			const std::string &,
+			const std::string &
+		) override
+		{
+			if (cert__ == __chain.front())
+				return __key;
+			return nullptr;
+		}
+	};
+
+	// Accepts until the acceptor is closed, every socket on a strand of its
+	// own, and hands it to on_accept__. After an error (out of descriptors,
+	// ...) it waits a moment instead of spinning on accept.
+	template<class OnAccept>
+	boost::asio::awaitable<void> accept_loop(boost::asio::ip::tcp::acceptor & acceptor__, OnAccept on_accept__)
+	{
+		for (;;)
+		{
+			auto [ec, socket] = co_await acceptor__.async_accept(
+				boost::asio::make_strand(acceptor__.get_executor()),
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			if (ec == boost::asio::error::operation_aborted)
+				co_return;
+			if (ec)
+			{
+				std::osyncstream{std::clog} << "accept: " << ec.message() << std::endl;
+				boost::asio::steady_timer timer{acceptor__.get_executor(), std::chrono::milliseconds(100)};
+				co_await timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+				continue;
+			}
+			on_accept__(std::move(socket));
+		}
+	}
+
+	using request_type = boost::beast::http::request<boost::beast::http::empty_body>;
+
+	// Requests on one connection, each answered by respond__ (an
+	// awaitable<bool>, false to stop), until the client does not keep it
+	// alive or a read fails or idles for 30 s.
+	template<class Stream, class Respond>
+	boost::asio::awaitable<void> serve_requests(Stream & stream__, Respond respond__)
+	{
+		boost::beast::flat_buffer buffer;
+		for (;;)
+		{
+			request_type request;
+			boost::beast::get_lowest_layer(stream__).expires_after(std::chrono::seconds(30));
+			auto [ec, bytes] = co_await boost::beast::http::async_read(
+				stream__,
+				buffer,
+				request,
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			if (ec)
+				co_return;
+			if (! co_await respond__(request))
+				co_return;
+			if (! request.keep_alive())
+				co_return;
+		}
+	}
+
+	// the server handshake, serve_requests() and close_notify
+	template<class Respond>
+	boost::asio::awaitable<void> serve_tls(Botan::TLS::Stream<boost::beast::tcp_stream> & stream__, Respond respond__)
+	{
+		stream__.next_layer().expires_after(std::chrono::seconds(10));
+		auto [ec] = co_await stream__.async_handshake(
+			Botan::TLS::Connection_Side::Server,
+			boost::asio::as_tuple(boost::asio::use_awaitable)
+		);
+		if (ec)
+			co_return;
+		co_await serve_requests(stream__, std::move(respond__));
+		stream__.next_layer().expires_after(std::chrono::seconds(2));
+		co_await stream__.async_shutdown(boost::asio::as_tuple(boost::asio::use_awaitable));
+	}
+}	// namespace uget::server
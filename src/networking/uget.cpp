@@ -13,7 +13,63 @@
 #include <botan/auto_rng.h>
 #include <botan/certstor_system.h>
 #include <botan/tls.h>
+#include <botan/hex.h>
+#include <botan/certstor.h>
+#include <botan/data_src.h>
+#include <botan/hash.h>
+#include <botan/x509path.h>
+#include <botan/ocsp.h>
+#if __has_include(<botan/system_rng.h>)
+#include <botan/system_rng.h>
+#define UGET_HAS_SYSTEM_RNG
+#endif
+#if __has_include(<botan/tls_session_manager_sqlite.h>)
+#include <botan/tls_session_manager_sqlite.h>
+#define UGET_HAS_SESSION_DB
+#endif
 #include <boost/signals2.hpp>
+#include <map>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <optional>
+#include <filesystem>
+#include <fstream>
+#include <cctype>
+#include <charconv>
+#include <iomanip>
+#include <cstdlib>
+#include <mutex>
+#include <functional>
+#include <array>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <atomic>
+#include <bit>
+#include <type_traits>
+#include <tuple>
+#include <set>
+#include <span>
+#include <limits>
+#include <csignal>
+#include <sstream>
+#include <ctime>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <thread>
+#include <syncstream>
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#include <zlib.h>
+#include <brotli/decode.h>
+#include <lyra/lyra.hpp>
+#include "uget-server.hpp"
 
 const std::string program_name = "uget";
 
@@ -23,7 +79,257 @@ using std::placeholders::_1;
 
 namespace uget
 {
-	class tls_client;
+	template<class Transport>
+	class basic_client;
+
+	// Per-request progress on std::clog: resolve, connect, pool reuse,
+	// request written, header read. The load test turns it off, so it
+	// measures requests and not writes to stderr. Failures are always logged.
+	class trace
+	{
+	private:
+		std::atomic<bool> __enabled{true};
+	public:
+		static uget::trace & shared()
+		{
+			static uget::trace result;
+			return result;
+		}
+	public:
+		void enable(bool enabled__)
+		{
+			__enabled.store(enabled__, std::memory_order_relaxed);
+		}
+		bool enabled() const
+		{
+			return __enabled.load(std::memory_order_relaxed);
+		}
+	};
+
+	// Power-of-two buckets bumped with relaxed atomics, so any number of
+	// clients, on any number of threads, record without a lock.
+	// Bucket i holds the values below 2^i.
+	class histogram
+	{
+	public:
+		static constexpr std::size_t bucket_count = 48;
+	private:
+		std::array<std::atomic<std::uint64_t>, bucket_count> __buckets{};
+		std::atomic<std::uint64_t> __count{0};
+		std::atomic<std::uint64_t> __sum{0};
+	public:
+		void record(std::uint64_t value__)
+		{
+			auto index = std::min<std::size_t>(std::bit_width(value__), bucket_count - 1);
+			__buckets[index].fetch_add(1, std::memory_order_relaxed);
+			__count.fetch_add(1, std::memory_order_relaxed);
+			__sum.fetch_add(value__, std::memory_order_relaxed);
+		}
+	public:
+		static std::uint64_t upper(std::size_t index__)
+		{
+			return std::uint64_t{1} << index__;
+		}
+		std::uint64_t bucket(std::size_t index__) const
+		{
+			return __buckets[index__].load(std::memory_order_relaxed);
+		}
+		std::uint64_t count() const
+		{
+			return __count.load(std::memory_order_relaxed);
+		}
+		std::uint64_t sum() const
+		{
+			return __sum.load(std::memory_order_relaxed);
+		}
+		// upper bound of the bucket holding the p-th value
+		std::uint64_t percentile(double p__) const
+		{
+			auto total = this->count();
+			if (total == 0)
+				return 0;
+			auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(p__ * total)));
+			std::uint64_t seen = 0;
+			for (std::size_t i = 0; i < bucket_count; ++i)
+			{
+				seen += this->bucket(i);
+				if (seen >= rank)
+					return upper(i);
+			}
+			return upper(bucket_count - 1);
+		}
+	};
+
+	// operator new calls made by this thread, counted by the replacement
+	// after the namespace; the load test reports them per request
+	inline thread_local std::uint64_t allocations = 0;
+
+	// Blocks of up to max_size bytes, kept per thread in power of two size
+	// classes and handed out again instead of going back to the heap. Each
+	// class keeps at most max_cached blocks, the rest are freed. A thread's
+	// pool frees what it holds when the thread exits; a block that comes
+	// back after that goes straight to the heap.
+	class block_pool
+	{
+	public:
+		static constexpr std::size_t min_size = 32;
+		static constexpr std::size_t max_size = 64 * 1024;
+		static constexpr std::size_t max_cached = 64;
+	private:
+		static constexpr std::size_t class_count = std::bit_width(max_size / min_size);
+		std::array<std::vector<void *>, class_count> __free;
+	public:
+		block_pool()
+		{
+			for (auto & list: __free)
+				list.reserve(max_cached);
+		}
+		block_pool(const block_pool &) = delete;
+		block_pool & operator=(const block_pool &) = delete;
+		~block_pool()
+		{
+			for (auto & list: __free)
+			{
+				for (auto block: list)
+					::operator delete(block);
+			}
+		}
+	public:
+		// from this thread's pool
+		static void * take(std::size_t size__)
+		{
+			if (auto pool = local())
+				return pool->allocate(size__);
+			return ::operator new(size__);
+		}
+		static void give(void * block__, std::size_t size__)
+		{
+			if (auto pool = local())
+				return pool->deallocate(block__, size__);
+			::operator delete(block__);
+		}
+	private:
+		// nullptr once the thread's pool is destroyed
+		static uget::block_pool * local()
+		{
+			struct owner
+			{
+				uget::block_pool pool;
+				bool & gone;
+			public:
+				~owner()
+				{
+					gone = true;
+				}
+			};
+			thread_local bool gone = false;
+			if (gone)
+				return nullptr;
+			thread_local owner local{{}, gone};
+			return & local.pool;
+		}
+	public:
+		void * allocate(std::size_t size__)
+		{
+			if (size__ > max_size)
+				return ::operator new(size__);
+			auto index = size_class(size__);
+			auto & list = __free[index];
+			if (list.empty())
+				return ::operator new(min_size << index);
+			auto block = list.back();
+			list.pop_back();
+			return block;
+		}
+		void deallocate(void * block__, std::size_t size__)
+		{
+			if (size__ > max_size)
+				return ::operator delete(block__);
+			auto & list = __free[size_class(size__)];
+			if (list.size() == max_cached)
+				return ::operator delete(block__);
+			list.push_back(block__);
+		}
+	private:
+		// 32 -> 0, 33..64 -> 1, ..., 64K -> 11
+		static std::size_t size_class(std::size_t size__)
+		{
+			return std::bit_width(std::max(size__, min_size) - 1) - std::bit_width(min_size - 1);
+		}
+	};
+
+	// An allocator over the thread's block_pool, for beast's header fields.
+	template<class T>
+	class recycling_allocator
+	{
+		static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	public:
+		using value_type = T;
+	public:
+		recycling_allocator() = default;
+		template<class U>
+		recycling_allocator(const uget::recycling_allocator<U> &) noexcept
+		{
+		}
+	public:
+		T * allocate(std::size_t n__)
+		{
+			return static_cast<T *>(uget::block_pool::take(n__ * sizeof(T)));
+		}
+		void deallocate(T * p__, std::size_t n__) noexcept
+		{
+			uget::block_pool::give(p__, n__ * sizeof(T));
+		}
+		template<class U>
+		bool operator==(const uget::recycling_allocator<U> &) const noexcept
+		{
+			return true;
+		}
+	};
+
+	// A buffer from the thread's block_pool, given back when it goes.
+	class pooled_buffer
+	{
+	private:
+		char * __data;
+		std::size_t __size;
+	public:
+		pooled_buffer():
+			__data{nullptr},
+			__size{0}
+		{
+		}
+		explicit pooled_buffer(std::size_t size__):
+			__data{static_cast<char *>(uget::block_pool::take(size__))},
+			__size{size__}
+		{
+		}
+		pooled_buffer(pooled_buffer && other__) noexcept:
+			__data{std::exchange(other__.__data, nullptr)},
+			__size{std::exchange(other__.__size, 0)}
+		{
+		}
+		pooled_buffer & operator=(pooled_buffer && other__) noexcept
+		{
+			std::swap(__data, other__.__data);
+			std::swap(__size, other__.__size);
+			return * this;
+		}
+		~pooled_buffer()
+		{
+			if (__data)
+				uget::block_pool::give(__data, __size);
+		}
+	public:
+		char * get() const
+		{
+			return __data;
+		}
+		explicit operator bool() const
+		{
+			return __data != nullptr;
+		}
+	};
 
 	class net_monitor
 	{
@@ -31,10 +337,42 @@ namespace uget
 		using signal_type = boost::signals2::signal<void(const std::string &)>;
 		using slot_type = signal_type::slot_type;
 		using connection_type = boost::signals2::connection;
+	public:
+		enum class phase
+		{
+			resolve,
+			connect,
+			handshake,
+			first_byte,	// request written -> response header read
+			transfer,	// response header -> end of body
+			request,	// whole request, retries included
+		};
+		static constexpr std::array<std::string_view, 6> phase_names{
+			"resolve",
+			"connect",
+			"handshake",
+			"first_byte",
+			"transfer",
+			"request"
+		};
 	private:
 		connection_type __connection;
+	private:
+		std::array<uget::histogram, phase_names.size()> __phases;	// microseconds
+		uget::histogram __bytes;
+		std::atomic<std::uint64_t> __failures;
+	private:
+		std::filesystem::path __metrics_path;
+		bool __prometheus;
+		std::optional<boost::asio::signal_set> __signals;
 	public:
-		net_monitor()
+		net_monitor():
+			__phases{},
+			__bytes{},
+			__failures{0},
+			__metrics_path{},
+			__prometheus{false},
+			__signals{}
 		{
 		}
 		virtual ~net_monitor()
@@ -42,15 +380,158 @@ namespace uget
 			__connection.disconnect();
 		}
 	public:
+		template<class Transport>
 		void attach(
 			int prior__,
-			uget::tls_client & client__
+			uget::basic_client<Transport> & client__
 		);
 	public:
 		void queue_message(const std::string & msg__)
 		{
 			std::clog << "================[net monitor] " << msg__ << std::endl;
 		}
+	public:
+		void record(phase phase__, std::chrono::steady_clock::duration time__)
+		{
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(time__).count();
+			__phases[static_cast<std::size_t>(phase__)].record(static_cast<std::uint64_t>(std::max<std::int64_t>(us, 0)));
+		}
+		void record_bytes(std::uint64_t bytes__)
+		{
+			__bytes.record(bytes__);
+		}
+		void record_failure()
+		{
+			__failures.fetch_add(1, std::memory_order_relaxed);
+		}
+	public:
+		// where dump() writes, "-" for stderr
+		void metrics(const std::filesystem::path & path__, bool prometheus__)
+		{
+			__metrics_path = path__;
+			__prometheus = prometheus__;
+		}
+		// SIGUSR1 dumps the metrics while requests are running
+		void listen(boost::asio::any_io_executor executor__)
+		{
+			if (__metrics_path.empty())
+				return;
+			__signals.emplace(executor__, SIGUSR1);
+			this->wait_signal();
+		}
+		// lets the io_context finish once the real work is done
+		void stop()
+		{
+			if (__signals)
+				__signals->cancel();
+		}
+		void dump() const
+		{
+			if (__metrics_path.empty())
+				return;
+			if (__metrics_path == "-")
+			{
+				this->dump(std::clog);
+				return;
+			}
+			auto temp = __metrics_path;
+			temp += ".tmp";
+			{
+				std::ofstream out{temp, std::ios::trunc};
+				this->dump(out);
+				if (! out)
+					throw std::runtime_error{"can not write " + temp.string()};
+			}
+			std::filesystem::rename(temp, __metrics_path);
+		}
+		void dump(std::ostream & out__) const
+		{
+			if (__prometheus)
+				this->dump_prometheus(out__);
+			else
+				this->dump_json(out__);
+		}
+		void dump_json(std::ostream & out__) const
+		{
+			auto write = [&out__] (const uget::histogram & h)
+			{
+				out__ << "{\"count\": " << h.count() << ", \"sum\": " << h.sum()
+					<< ", \"p50\": " << h.percentile(0.50)
+					<< ", \"p99\": " << h.percentile(0.99)
+					<< ", \"p999\": " << h.percentile(0.999)
+					<< ", \"buckets\": {";
+				const char * comma = "";
+				for (std::size_t i = 0; i < uget::histogram::bucket_count; ++i)
+				{
+					if (auto n = h.bucket(i); n != 0)
+					{
+						out__ << comma << "\"" << uget::histogram::upper(i) << "\": " << n;
+						comma = ", ";
+					}
+				}
+				out__ << "}}";
+			};
+			out__ << "{\n\t\"unit\": \"us\",\n\t\"failures\": " << __failures.load() << ",\n\t\"phases\": {\n";
+			for (std::size_t i = 0; i < __phases.size(); ++i)
+			{
+				out__ << "\t\t\"" << phase_names[i] << "\": ";
+				write(__phases[i]);
+				out__ << (i + 1 == __phases.size() ? "\n" : ",\n");
+			}
+			out__ << "\t},\n\t\"bytes\": ";
+			write(__bytes);
+			out__ << "\n}\n";
+		}
+		void dump_prometheus(std::ostream & out__) const
+		{
+			auto write = [&out__] (
+				const uget::histogram & h,
+				std::string_view name,
+				std::string_view labels,
+				double scale
+			)
+			{
+				std::uint64_t cumulative = 0;
+				for (std::size_t i = 0; i < uget::histogram::bucket_count; ++i)
+				{
+					cumulative += h.bucket(i);
+					out__ << name << "_bucket{" << labels << (labels.empty() ? "" : ",")
+						<< "le=\"" << uget::histogram::upper(i) * scale << "\"} " << cumulative << '\n';
+				}
+				std::string braces = labels.empty() ? ""s : "{"s + std::string{labels} + "}";
+				out__ << name << "_bucket{" << labels << (labels.empty() ? "" : ",")
+					<< "le=\"+Inf\"} " << h.count() << '\n'
+					<< name << "_sum" << braces << ' ' << h.sum() * scale << '\n'
+					<< name << "_count" << braces << ' ' << h.count() << '\n';
+			};
+			out__ << "# TYPE uget_phase_seconds histogram\n";
+			for (std::size_t i = 0; i < __phases.size(); ++i)
+				write(__phases[i], "uget_phase_seconds", "phase=\""s + std::string{phase_names[i]} + '"', 1e-6);
+			out__ << "# TYPE uget_response_bytes histogram\n";
+			write(__bytes, "uget_response_bytes", "", 1);
+			out__ << "# TYPE uget_failures_total counter\n"
+				<< "uget_failures_total " << __failures.load() << '\n';
+		}
+	private:
+		void wait_signal()
+		{
+			__signals->async_wait(
+				[this] (const boost::system::error_code & ec, int)
+				{
+					if (ec)
+						return;
+					try
+					{
+						this->dump();
+					}
+					catch (const std::exception & e)
+					{
+						std::clog << "metrics: " << e.what() << std::endl;
+					}
+					this->wait_signal();
+				}
+			);
+		}
 	};
 
 	class credentials_manager:
@@ -62,350 +543,6508 @@ namespace uget
 		std::vector<Botan::Certificate_Store *>
 			trusted_certificate_authorities(const std::string &, const std::string &) override
 		{
-			return {&__store};
+			return {&__store, &extra()};
+		}
+	public:
+		// --ca-file: trust the certificates in a PEM file as well, e.g. the
+		// CA of uget-bench-server; call from main before any client starts
+		static void trust(const std::filesystem::path & pem__)
+		{
+			Botan::DataSource_Stream in{pem__.string()};
+			std::size_t count = 0;
+			while (! in.end_of_data())
+			{
+				try
+				{
+					extra().add_certificate(Botan::X509_Certificate{in});
+					++count;
+				}
+				catch (const Botan::Decoding_Error &)
+				{
+					break;
+				}
+			}
+			if (count == 0)
+				throw std::runtime_error{"no certificate in " + pem__.string()};
+		}
+		static void trust(const Botan::X509_Certificate & certificate__)
+		{
+			extra().add_certificate(certificate__);
+		}
+	private:
+		static Botan::Certificate_Store_In_Memory & extra()
+		{
+			static Botan::Certificate_Store_In_Memory store;
+			return store;
 		}
 	};
 
-	class tls_client: virtual public std::enable_shared_from_this<uget::tls_client>
+	// $UGET_CACHE_DIR, else $XDG_CACHE_HOME/uget, else ~/.cache/uget
+	inline std::filesystem::path cache_dir()
+	{
+		if (const char * dir = std::getenv("UGET_CACHE_DIR"); dir && * dir)
+			return dir;
+		if (const char * dir = std::getenv("XDG_CACHE_HOME"); dir && * dir)
+			return std::filesystem::path{dir} / program_name;
+		if (const char * dir = std::getenv("HOME"); dir && * dir)
+			return std::filesystem::path{dir} / ".cache" / program_name;
+		return std::filesystem::temp_directory_path() / program_name;
+	}
+
+	// The process RNG, shared by everything TLS does. The system RNG is safe
+	// to use from any thread and needs no seeding; without it, Botan's
+	// AutoSeeded_RNG, which locks internally.
+	inline std::shared_ptr<Botan::RandomNumberGenerator> rng()
+	{
+#ifdef UGET_HAS_SYSTEM_RNG
+		static auto rng = std::make_shared<Botan::System_RNG>();
+#else
+		static auto rng = std::make_shared<Botan::AutoSeeded_RNG>();
+#endif
+		return rng;
+	}
+
+	// The process-wide TLS session manager. With Botan's sqlite module the
+	// sessions and TLS 1.3 tickets live in a database file, encrypted with a
+	// key kept next to it, so the next run of uget resumes instead of doing
+	// a full handshake. Without it, sessions are only shared in memory.
+	class session_cache
 	{
 	private:
-		const std::string __host;
-		const std::string __port;
-		const std::string __uri;
+		static std::shared_ptr<Botan::TLS::Session_Manager> & opened()
+		{
+			static std::shared_ptr<Botan::TLS::Session_Manager> manager;
+			return manager;
+		}
+	public:
+		// call once from main, before the first client is created
+		static void open(const std::filesystem::path & db__)
+		{
+#ifdef UGET_HAS_SESSION_DB
+			std::filesystem::create_directories(db__.parent_path());
+			auto rng = uget::rng();
+			opened() = std::make_shared<Botan::TLS::Session_Manager_SQLite>(
+				key(db__.string() + ".key", * rng),
+				rng,
+				db__.string()
+			);
+			std::clog << "tls session cache: " << db__ << std::endl;
+#else
+			std::clog << "tls session cache: botan is built without sqlite, "
+				<< db__ << " is not used" << std::endl;
+#endif
+		}
+		static std::shared_ptr<Botan::TLS::Session_Manager> shared()
+		{
+			if (auto & manager = opened(); manager)
+				return manager;
+			static auto memory = std::make_shared<Botan::TLS::Session_Manager_In_Memory>(uget::rng());
+			return memory;
+		}
 	private:
-		boost::asio::ip::tcp::resolver __resolver;
+		// read the passphrase, or create it readable by the owner only
+		static std::string key(const std::filesystem::path & path__, Botan::RandomNumberGenerator & rng__)
+		{
+			std::string passphrase;
+			if (std::ifstream in{path__}; in >> passphrase && passphrase.size() == 64)
+				return passphrase;
+
+			std::ofstream{path__, std::ios::trunc};
+			std::filesystem::permissions(
+				path__,
+				std::filesystem::perms::owner_read | std::filesystem::perms::owner_write,
+				std::filesystem::perm_options::replace
+			);
+			passphrase = Botan::hex_encode(rng__.random_vec(32));
+			std::ofstream out{path__, std::ios::trunc};
+			out << passphrase << '\n';
+			if (! out)
+				throw std::runtime_error{"can not write " + path__.string()};
+			return passphrase;
+		}
+	};
+
+	// Process-wide cache of resolved addresses. The system resolver does
+	// not tell us the record TTL, so entries live for a fixed time.
+	class dns_cache
+	{
+	public:
+		using clock_type = std::chrono::steady_clock;
+		using endpoint_type = boost::asio::ip::tcp::endpoint;
 	private:
-		std::shared_ptr<Botan::RNG> __tls_rng;
-		std::shared_ptr<Botan::Credentials_Manager> __tls_credentials;
-		std::shared_ptr<Botan::TLS::Session_Manager> __tls_session;
-		std::shared_ptr<Botan::TLS::Policy> __tls_policy;
-		Botan::TLS::Server_Information __tls_server_info;
-		std::shared_ptr<Botan::TLS::Context> __tls_context;
-		std::shared_ptr<Botan::TLS::Stream<boost::beast::tcp_stream>> __tls_stream;
+		struct entry
+		{
+			std::vector<endpoint_type> endpoints;
+			clock_type::time_point expires;
+		};
 	private:
-		boost::beast::http::request<boost::beast::http::empty_body> __request;
-		boost::beast::http::response<boost::beast::http::string_body> __response;
-		boost::beast::flat_buffer __buffer;
+		std::mutex __mutex;
+		std::map<std::string, entry> __entries;
+		std::map<std::string, std::vector<endpoint_type>> __pinned;
+		clock_type::duration __ttl;
+	public:
+		dns_cache():
+			__mutex{},
+			__entries{},
+			__pinned{},
+			__ttl{std::chrono::seconds(60)}
+		{
+		}
+	public:
+		static uget::dns_cache & shared()
+		{
+			static uget::dns_cache cache;
+			return cache;
+		}
+	public:
+		void ttl(clock_type::duration ttl__)
+		{
+			std::unique_lock lock{__mutex};
+			__ttl = ttl__;
+		}
+		// host__:port__ resolves to endpoints__ from now on, e.g. to a replay_server
+		void pin(const std::string & host__, const std::string & port__, std::vector<endpoint_type> endpoints__)
+		{
+			std::unique_lock lock{__mutex};
+			__pinned[host__ + ':' + port__] = std::move(endpoints__);
+		}
+		// called when none of the cached addresses could be reached
+		void forget(const std::string & host__, const std::string & port__)
+		{
+			std::unique_lock lock{__mutex};
+			__entries.erase(host__ + ':' + port__);
+		}
+	public:
+		boost::asio::awaitable<std::vector<endpoint_type>> resolve(
+			boost::asio::ip::tcp::resolver & resolver__,
+			const std::string & host__,
+			const std::string & port__
+		)
+		{
+			const std::string key = host__ + ':' + port__;
+			{
+				std::unique_lock lock{__mutex};
+				if (auto pinned = __pinned.find(key); pinned != __pinned.end())
+					co_return pinned->second;
+				auto it = __entries.find(key);
+				if (it != __entries.end() && it->second.expires > clock_type::now())
+				{
+					if (uget::trace::shared().enabled())
+						std::clog << "dns cache hit: " << key << std::endl;
+					co_return it->second.endpoints;
+				}
+			}
+
+			auto [ec, results] = co_await resolver__.async_resolve(
+				host__,
+				port__,
+				boost::asio::as_tuple(
+					boost::asio::use_awaitable
+				)
+			);
+			if (ec)
+				throw std::system_error{ec, "async resolve error"};
+			if (uget::trace::shared().enabled())
+				std::clog << "async resolve ok" << std::endl;
+
+			auto endpoints = interleave(results);
+			std::unique_lock lock{__mutex};
+			if (__ttl > clock_type::duration::zero())
+				__entries[key] = {endpoints, clock_type::now() + __ttl};
+			co_return endpoints;
+		}
+	private:
+		// RFC 8305 section 4: IPv6 first, then alternate the families
+		static std::vector<endpoint_type> interleave(
+			const boost::asio::ip::tcp::resolver::results_type & results__
+		)
+		{
+			std::vector<endpoint_type> v6, v4, result;
+			for (const auto & entry: results__)
+				(entry.endpoint().address().is_v6() ? v6 : v4).push_back(entry.endpoint());
+			for (std::size_t i = 0; i < std::max(v6.size(), v4.size()); ++i)
+			{
+				if (i < v6.size())
+					result.push_back(v6[i]);
+				if (i < v4.size())
+					result.push_back(v4[i]);
+			}
+			return result;
+		}
+	};
+
+	// Happy eyeballs (RFC 8305): start the next address every __stagger, or
+	// as soon as the previous attempt fails; the first socket to connect
+	// wins and the others are cancelled. A dead first address then costs
+	// one stagger delay instead of a whole connect timeout.
+	class connect_race: virtual public std::enable_shared_from_this<uget::connect_race>
+	{
+	public:
+		using endpoint_type = boost::asio::ip::tcp::endpoint;
+	private:
+		const std::vector<endpoint_type> __endpoints;
+		const std::chrono::steady_clock::duration __stagger;
+		const std::chrono::steady_clock::duration __timeout;
+	private:
+		std::vector<std::shared_ptr<boost::beast::tcp_stream>> __attempts;
+		std::optional<boost::asio::ip::tcp::socket> __winner;
+		std::size_t __running;
+		boost::system::error_code __error;
+		boost::asio::steady_timer __wakeup;
+		bool __cancelled;
+	public:
+		connect_race(
+			boost::asio::any_io_executor executor__,
+			const std::vector<endpoint_type> & endpoints__,
+			std::chrono::steady_clock::duration stagger__,
+			std::chrono::steady_clock::duration timeout__
+		):
+			__endpoints{endpoints__},
+			__stagger{stagger__},
+			__timeout{timeout__},
+
+			__attempts{},
+			__winner{},
+			__running{0},
+			__error{boost::asio::error::host_not_found},
+			__wakeup{executor__},
+			__cancelled{false}
+		{
+		}
+	public:
+		// the connected socket, or throws the last connect error
+		boost::asio::awaitable<boost::asio::ip::tcp::socket> run()
+		{
+			auto self = this->shared_from_this();
+			auto executor = co_await boost::asio::this_coro::executor;
+			for (std::size_t i = 0; i < __endpoints.size() && ! __winner && ! __cancelled; ++i)
+			{
+				++__running;
+				boost::asio::co_spawn(
+					executor,
+					this->attempt(self, executor, __endpoints[i]),
+					boost::asio::detached
+				);
+				if (i + 1 == __endpoints.size())
+					break;
+				// wakes up early when an attempt finishes either way
+				__wakeup.expires_after(__stagger);
+				co_await __wakeup.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+			}
+			while (! __winner && ! __cancelled && __running != 0)
+			{
+				__wakeup.expires_at(boost::asio::steady_timer::time_point::max());
+				co_await __wakeup.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+			}
+			if (__cancelled)
+				throw std::system_error{std::make_error_code(std::errc::operation_canceled), "connect cancelled"};
+			if (! __winner)
+				throw std::system_error{__error, "async connect error"};
+			co_return std::move(* __winner);
+		}
+		// run() gives up at once, the attempts still connecting are cancelled
+		void cancel()
+		{
+			__cancelled = true;
+			for (auto & attempt: __attempts)
+				attempt->cancel();
+			__wakeup.cancel();
+		}
+	private:
+		// self__ keeps the race alive until every attempt has finished
+		boost::asio::awaitable<void> attempt(
+			std::shared_ptr<uget::connect_race> self__,
+			boost::asio::any_io_executor executor__,
+			endpoint_type endpoint__
+		)
+		{
+			if (__winner || __cancelled)
+			{
+				--__running;
+				co_return;
+			}
+			auto stream = std::make_shared<boost::beast::tcp_stream>(executor__);
+			__attempts.push_back(stream);
+
+			stream->expires_after(__timeout);
+			auto [ec] = co_await stream->async_connect(
+				endpoint__,
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			--__running;
+			if (! ec && ! __winner && ! __cancelled)
+			{
+				if (uget::trace::shared().enabled())
+					std::clog << "connected to " << endpoint__ << std::endl;
+				stream->expires_never();
+				__winner.emplace(stream->release_socket());
+				for (auto & other: __attempts)
+				{
+					if (other != stream)
+						other->cancel();
+				}
+			}
+			else if (ec && ec != boost::asio::error::operation_aborted)
+			{
+				std::clog << "connect to " << endpoint__ << " failed: " << ec.message() << std::endl;
+				__error = ec;
+			}
+			__wakeup.cancel();
+		}
+	};
+
+	// How hard one request tries: a deadline for getting the response
+	// header (resolve, connect, handshake, write, header and the backoff
+	// between attempts; 0 is none), a timeout per phase, and capped
+	// exponential backoff with jitter between attempts. The body is only
+	// held to the read timeout, per chunk, so it is an idle timeout and a
+	// large body takes as long as it takes.
+	class retry_policy
+	{
+	public:
+		using duration_type = std::chrono::steady_clock::duration;
+		using retryable_type = std::function<bool(const std::error_code &)>;
+	public:
+		duration_type deadline = std::chrono::seconds(120);
+		duration_type connect_timeout = std::chrono::seconds(5);
+		duration_type handshake_timeout = std::chrono::seconds(10);
+		duration_type write_timeout = std::chrono::seconds(10);
+		duration_type read_timeout = std::chrono::seconds(30);
+		int max_attempts = 4;
+		duration_type backoff = std::chrono::milliseconds(200);
+		duration_type backoff_max = std::chrono::seconds(10);
+		double jitter = 0.5;	// 0: fixed delays, 1: anywhere in [0, delay]
+		retryable_type retryable = transient;
+	public:
+		// errors a fresh connection can plausibly get past
+		static bool transient(const std::error_code & ec__)
+		{
+			static const std::array<boost::system::error_code, 12> errors{
+				boost::beast::error::timeout,
+				boost::asio::error::timed_out,
+				boost::asio::error::eof,
+				boost::beast::http::error::end_of_stream,
+				boost::beast::http::error::partial_message,
+				boost::asio::error::connection_refused,
+				boost::asio::error::connection_reset,
+				boost::asio::error::connection_aborted,
+				boost::asio::error::broken_pipe,
+				boost::asio::error::network_unreachable,
+				boost::asio::error::host_unreachable,
+				boost::asio::error::host_not_found_try_again
+			};
+			return std::ranges::any_of(
+				errors,
+				[&ec__] (const boost::system::error_code & e)
+				{
+					return ec__ == static_cast<std::error_code>(e);
+				}
+			);
+		}
+		// how the first write or read on a connection the server closed
+		// while it sat in the pool fails
+		static bool closed(const std::error_code & ec__)
+		{
+			static const std::array<boost::system::error_code, 4> errors{
+				boost::asio::error::eof,
+				boost::beast::http::error::end_of_stream,
+				boost::asio::error::connection_reset,
+				boost::asio::error::broken_pipe
+			};
+			return std::ranges::any_of(
+				errors,
+				[&ec__] (const boost::system::error_code & e)
+				{
+					return ec__ == static_cast<std::error_code>(e);
+				}
+			);
+		}
+	public:
+		// delay before attempt__ + 1
+		duration_type delay(int attempt__) const
+		{
+			thread_local std::minstd_rand engine{std::random_device{}()};
+			auto delay = backoff;
+			for (int i = 1; i < attempt__ && delay < backoff_max; ++i)
+				delay *= 2;
+			delay = std::min(delay, backoff_max);
+			std::uniform_real_distribution<double> dist{1.0 - jitter, 1.0};
+			return std::chrono::duration_cast<duration_type>(delay * dist(engine));
+		}
+	public:
+		// "retries=6,deadline=300,read-timeout=60,backoff=0.5", times in seconds
+		void apply(std::string_view spec__)
+		{
+			while (! spec__.empty())
+			{
+				auto comma = spec__.find(',');
+				auto item = spec__.substr(0, comma);
+				spec__ = comma == std::string_view::npos ? "" : spec__.substr(comma + 1);
+
+				auto equal = item.find('=');
+				if (equal == std::string_view::npos)
+					throw std::runtime_error{"policy: expected key=value, got "s + std::string{item}};
+				auto name = item.substr(0, equal);
+				double value = std::stod(std::string{item.substr(equal + 1)});
+				auto seconds = std::chrono::duration_cast<duration_type>(
+					std::chrono::duration<double>(value)
+				);
+
+				if (name == "deadline")
+					deadline = seconds;
+				else if (name == "connect-timeout")
+					connect_timeout = seconds;
+				else if (name == "handshake-timeout")
+					handshake_timeout = seconds;
+				else if (name == "write-timeout")
+					write_timeout = seconds;
+				else if (name == "read-timeout")
+					read_timeout = seconds;
+				else if (name == "retries")
+					max_attempts = std::max(1, static_cast<int>(value) + 1);
+				else if (name == "backoff")
+					backoff = seconds;
+				else if (name == "backoff-max")
+					backoff_max = seconds;
+				else if (name == "jitter")
+					jitter = std::clamp(value, 0.0, 1.0);
+				else
+					throw std::runtime_error{"policy: unknown key "s + std::string{name}};
+			}
+		}
+	};
+
+	// The default retry_policy and per-host overrides.
+	// Filled in by main before any request starts, read-only afterwards.
+	class policy_registry
+	{
+	private:
+		uget::retry_policy __default;
+		std::map<std::string, uget::retry_policy, std::less<>> __hosts;
+	public:
+		static uget::policy_registry & shared()
+		{
+			static uget::policy_registry registry;
+			return registry;
+		}
+	public:
+		uget::retry_policy & fallback()
+		{
+			return __default;
+		}
+		// "host:key=value,..." starts from the default policy
+		void apply_host(std::string_view spec__)
+		{
+			auto colon = spec__.find(':');
+			if (colon == std::string_view::npos)
+				throw std::runtime_error{"policy: expected host:key=value,..."};
+			auto [it, inserted] = __hosts.try_emplace(std::string{spec__.substr(0, colon)}, __default);
+			it->second.apply(spec__.substr(colon + 1));
+		}
+		const uget::retry_policy & find(std::string_view host__) const
+		{
+			auto it = __hosts.find(host__);
+			return it == __hosts.end() ? __default : it->second;
+		}
+	};
+
+	// Tokens come back at __rate per second, up to __burst. A take may run
+	// the balance below zero and then waits on a timer until the debt is
+	// paid off; whoever takes next queues up behind that debt, so takers
+	// are served in order and a throttled transfer is only a suspended
+	// coroutine, never a blocked thread.
+	class token_bucket
+	{
+	public:
+		using clock_type = std::chrono::steady_clock;
+	private:
+		std::mutex __mutex;
+		double __rate;
+		double __burst;
+		double __tokens;
+		clock_type::time_point __last;
+	public:
+		token_bucket():
+			__mutex{},
+			__rate{0},
+			__burst{0},
+			__tokens{0},
+			__last{clock_type::now()}
+		{
+		}
+	public:
+		// per second; 0 is unlimited, burst 0 is one second's worth
+		void set(double rate__, double burst__ = 0)
+		{
+			std::lock_guard lock{__mutex};
+			__rate = std::max(rate__, 0.0);
+			__burst = burst__ > 0 ? burst__ : __rate;
+			__tokens = __burst;
+			__last = clock_type::now();
+		}
+		bool limited() const
+		{
+			return __rate > 0;
+		}
+		// takes amount__ and says how long to wait before using it
+		clock_type::duration debit(double amount__)
+		{
+			if (! this->limited())
+				return clock_type::duration::zero();
+			std::lock_guard lock{__mutex};
+			auto now = clock_type::now();
+			std::chrono::duration<double> elapsed = now - __last;
+			__last = now;
+			__tokens = std::min(__burst, __tokens + elapsed.count() * __rate) - amount__;
+			if (__tokens >= 0)
+				return clock_type::duration::zero();
+			return std::chrono::duration_cast<clock_type::duration>(
+				std::chrono::duration<double>(-__tokens / __rate)
+			);
+		}
+	public:
+		static boost::asio::awaitable<void> wait(clock_type::duration delay__)
+		{
+			if (delay__ <= clock_type::duration::zero())
+				co_return;
+			boost::asio::steady_timer timer{co_await boost::asio::this_coro::executor};
+			timer.expires_after(delay__);
+			co_await timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+		}
+	};
+
+	// Global and per-host token buckets for response bytes and for requests.
+	// Set up by main before any request starts. Clients call request() before
+	// a request goes out and bytes() after every chunk that comes in, so a
+	// throttled body also stops the socket reads and TCP pushes back.
+	// A transfer waits for whichever of its buckets is further behind.
+	class rate_limits
+	{
+	public:
+		// per second, 0 is unlimited
+		struct limits
+		{
+			double bytes = 0;
+			double requests = 0;
+		};
+	private:
+		struct buckets
+		{
+			uget::token_bucket bytes;
+			uget::token_bucket requests;
+		public:
+			void set(const limits & limits__)
+			{
+				bytes.set(limits__.bytes);
+				requests.set(limits__.requests, std::max(limits__.requests, 1.0));
+			}
+		};
+	private:
+		std::mutex __mutex;
+		bool __enabled;
+		buckets __global;
+		limits __per_host;
+		std::map<std::string, limits, std::less<>> __overrides;
+		std::map<std::string, buckets, std::less<>> __hosts;
+	public:
+		rate_limits():
+			__mutex{},
+			__enabled{false},
+			__global{},
+			__per_host{},
+			__overrides{},
+			__hosts{}
+		{
+		}
+	public:
+		static uget::rate_limits & shared()
+		{
+			static uget::rate_limits limits;
+			return limits;
+		}
+	public:
+		bool enabled() const
+		{
+			return __enabled;
+		}
+		// "rate=<bytes>,requests=<n>,host-rate=<bytes>,host-requests=<n>",
+		// bytes with an optional k, M or G; the host- ones apply to every host
+		void apply(std::string_view spec__)
+		{
+			limits global;
+			parse(spec__, global, & __per_host);
+			__global.set(global);
+			__enabled = __enabled || global.bytes > 0 || global.requests > 0
+				|| __per_host.bytes > 0 || __per_host.requests > 0;
+		}
+		// "host:rate=<bytes>,requests=<n>", instead of host-rate and host-requests
+		void apply_host(std::string_view spec__)
+		{
+			auto colon = spec__.find(':');
+			if (colon == std::string_view::npos)
+				throw std::runtime_error{"limit: expected host:key=value,..."};
+			auto [it, inserted] = __overrides.try_emplace(std::string{spec__.substr(0, colon)}, __per_host);
+			parse(spec__.substr(colon + 1), it->second, nullptr);
+			__enabled = __enabled || it->second.bytes > 0 || it->second.requests > 0;
+		}
+	public:
+		boost::asio::awaitable<void> request(std::string_view host__)
+		{
+			co_await uget::token_bucket::wait(std::max(
+				__global.requests.debit(1),
+				this->host(host__).requests.debit(1)
+			));
+		}
+		boost::asio::awaitable<void> bytes(std::string_view host__, std::size_t bytes__)
+		{
+			co_await uget::token_bucket::wait(std::max(
+				__global.bytes.debit(static_cast<double>(bytes__)),
+				this->host(host__).bytes.debit(static_cast<double>(bytes__))
+			));
+		}
+	private:
+		buckets & host(std::string_view host__)
+		{
+			std::lock_guard lock{__mutex};
+			auto it = __hosts.find(host__);
+			if (it != __hosts.end())
+				return it->second;
+			it = __hosts.try_emplace(std::string{host__}).first;
+			auto limits = __overrides.find(host__);
+			it->second.set(limits == __overrides.end() ? __per_host : limits->second);
+			return it->second;
+		}
+		static void parse(std::string_view spec__, limits & limits__, limits * per_host__)
+		{
+			while (! spec__.empty())
+			{
+				auto comma = spec__.find(',');
+				auto item = spec__.substr(0, comma);
+				spec__ = comma == std::string_view::npos ? "" : spec__.substr(comma + 1);
+
+				auto equal = item.find('=');
+				if (equal == std::string_view::npos)
+					throw std::runtime_error{"limit: expected key=value, got "s + std::string{item}};
+				auto name = item.substr(0, equal);
+				auto value = item.substr(equal + 1);
+
+				if (name == "rate")
+					limits__.bytes = size(value);
+				else if (name == "requests")
+					limits__.requests = std::stod(std::string{value});
+				else if (per_host__ && name == "host-rate")
+					per_host__->bytes = size(value);
+				else if (per_host__ && name == "host-requests")
+					per_host__->requests = std::stod(std::string{value});
+				else
+					throw std::runtime_error{"limit: unknown key "s + std::string{name}};
+			}
+		}
+		// 500k, 10M, 1.5G
+		static double size(std::string_view text__)
+		{
+			double scale = 1;
+			if (! text__.empty())
+			{
+				switch (text__.back())
+				{
+				case 'k': case 'K': scale = 1024; break;
+				case 'm': case 'M': scale = 1024 * 1024; break;
+				case 'g': case 'G': scale = 1024 * 1024 * 1024; break;
+				}
+				if (scale != 1)
+					text__.remove_suffix(1);
+			}
+			return std::stod(std::string{text__}) * scale;
+		}
+	};
+
+	// TLS settings for every connection, picked with --tls-policy:
+	//
+	//	default	Botan's own policy
+	//	tuned	AEAD suites in the order this cpu runs fastest, TLS 1.3 offered
+	//		first, TLS 1.2 kept for servers without it; a resumption ticket
+	//		may be offered on several connections, so a batch of parallel
+	//		connections to one host all resume instead of one
+	//	tls13	tuned, without TLS 1.2
+	//
+	// With AES instructions AES-GCM is fastest; without them ChaCha20-Poly1305
+	// is faster and, unlike table based AES, constant time.
+	class tls_policy: virtual public Botan::TLS::Policy
+	{
+	private:
+		const bool __tls13_only;
+		const bool __aes;
+	public:
+		explicit tls_policy(bool tls13_only__):
+			__tls13_only{tls13_only__},
+			__aes{has_aes()}
+		{
+		}
+	public:
+		std::vector<std::string> allowed_ciphers() const override
+		{
+			if (__aes)
+				return {"AES-128/GCM", "AES-256/GCM", "ChaCha20Poly1305"};
+			return {"ChaCha20Poly1305", "AES-128/GCM", "AES-256/GCM"};
+		}
+		bool allow_tls12() const override
+		{
+			return ! __tls13_only;
+		}
+		bool reuse_session_tickets() const override
+		{
+			return true;
+		}
+	public:
+		static std::shared_ptr<Botan::TLS::Policy> & shared()
+		{
+			static std::shared_ptr<Botan::TLS::Policy> policy = std::make_shared<Botan::TLS::Policy>();
+			return policy;
+		}
+		static void select(std::string_view name__)
+		{
+			if (name__ == "default")
+				shared() = std::make_shared<Botan::TLS::Policy>();
+			else if (name__ == "tuned")
+				shared() = std::make_shared<uget::tls_policy>(false);
+			else if (name__ == "tls13")
+				shared() = std::make_shared<uget::tls_policy>(true);
+			else
+				throw std::runtime_error{"--tls-policy is default, tuned or tls13"};
+		}
+		static bool has_aes()
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#elif defined(__aarch64__) && defined(__linux__)
+			return (::getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+			return false;
+#endif
+		}
+	};
+
+	// What every TLS connection shares: the RNG, one credentials manager,
+	// so the system certificate store is read once, the session cache, the
+	// policy, and one TLS::Context per (host, port), since that is where
+	// Botan keeps the name for SNI and for the certificate check. Created on
+	// first use, after main has set up the session cache and the policy.
+	//
+	// A chain that validated for a host is remembered by the SHA-256 of its
+	// leaf for an hour, never past the leaf's expiry, so a repeat connection
+	// that does not resume a session skips path validation.
+	class tls_contexts
+	{
+	private:
+		// verified chains kept at most; a crawl meets more hosts than this
+		static constexpr std::size_t max_verified = 4096;
+	private:
+		std::mutex __mutex;
+		std::shared_ptr<Botan::Credentials_Manager> __credentials;
+		std::map<std::string, std::shared_ptr<Botan::TLS::Context>, std::less<>> __contexts;
+		std::map<std::string, std::chrono::system_clock::time_point> __verified;
+		std::chrono::system_clock::duration __verified_for;
+	public:
+		tls_contexts():
+			__mutex{},
+			__credentials{std::make_shared<uget::credentials_manager>()},
+			__contexts{},
+			__verified{},
+			__verified_for{std::chrono::hours(1)}
+		{
+		}
+	public:
+		static uget::tls_contexts & shared()
+		{
+			static uget::tls_contexts contexts;
+			return contexts;
+		}
+	public:
+		std::shared_ptr<Botan::TLS::Context> context(const std::string_view host__, const std::string_view port__)
+		{
+			auto key = std::string{host__} + ':' + std::string{port__};
+			std::lock_guard lock{__mutex};
+			if (auto it = __contexts.find(key); it != __contexts.end())
+				return it->second;
+
+			auto context = std::make_shared<Botan::TLS::Context>(
+				__credentials,
+				uget::rng(),
+				uget::session_cache::shared(),
+				uget::tls_policy::shared(),
+				// sessions are looked up by server, and the certificate is checked against the host
+				Botan::TLS::Server_Information{std::string{host__}, port_number(port__)}
+			);
+			context->set_verify_callback(
+				[this] (
+					const std::vector<Botan::X509_Certificate> & chain__,
+					const std::vector<std::optional<Botan::OCSP::Response>> & ocsp__,
+					const std::vector<Botan::Certificate_Store *> & roots__,
+					Botan::Usage_Type usage__,
+					std::string_view hostname__,
+					const Botan::TLS::Policy & policy__
+				)
+				{
+					this->verify(chain__, ocsp__, roots__, usage__, hostname__, policy__);
+				}
+			);
+			__contexts.emplace(std::move(key), context);
+			return context;
+		}
+	private:
+		// "8443", or the service names the resolver takes for the transports
+		static std::uint16_t port_number(std::string_view port__)
+		{
+			if (port__ == "https")
+				return 443;
+			if (port__ == "http")
+				return 80;
+			unsigned long number = 0;
+			auto [ptr, ec] = std::from_chars(port__.data(), port__.data() + port__.size(), number);
+			if (ec != std::errc{} || ptr != port__.data() + port__.size() || number == 0 || number > 65535)
+				throw std::runtime_error{"tls: port must be 1..65535, https or http, got \"" + std::string{port__} + '"'};
+			return static_cast<std::uint16_t>(number);
+		}
+		// what Botan::TLS::Callbacks::tls_verify_cert_chain does, behind the cache
+		void verify(
+			const std::vector<Botan::X509_Certificate> & chain__,
+			const std::vector<std::optional<Botan::OCSP::Response>> & ocsp__,
+			const std::vector<Botan::Certificate_Store *> & roots__,
+			Botan::Usage_Type usage__,
+			std::string_view hostname__,
+			const Botan::TLS::Policy & policy__
+		)
+		{
+			if (chain__.empty())
+				throw std::invalid_argument{"certificate chain is empty"};
+			const auto & leaf = chain__.front();
+			auto key = leaf.fingerprint("SHA-256") + ' ' + std::string{hostname__};
+			auto now = std::chrono::system_clock::now();
+			{
+				std::lock_guard lock{__mutex};
+				if (auto it = __verified.find(key); it != __verified.end())
+				{
+					if (now < it->second)
+						return;
+					__verified.erase(it);
+				}
+			}
+
+			Botan::Path_Validation_Restrictions restrictions{
+				policy__.require_cert_revocation_info(),
+				policy__.minimum_signature_strength()
+			};
+			auto result = Botan::x509_path_validate(
+				chain__,
+				restrictions,
+				roots__,
+				hostname__,
+				usage__,
+				now,
+				std::chrono::milliseconds(0),
+				ocsp__
+			);
+			if (! result.successful_validation())
+				throw Botan::TLS::TLS_Exception{
+					Botan::TLS::AlertType::BadCertificate,
+					"certificate validation failure: " + result.result_string()
+				};
+
+			std::lock_guard lock{__mutex};
+			// expired entries go on insert, and the one expiring first when still full
+			std::erase_if(__verified, [now] (const auto & entry) { return entry.second <= now; });
+			if (__verified.size() >= max_verified && ! __verified.contains(key))
+				__verified.erase(std::ranges::min_element(__verified, {}, &decltype(__verified)::value_type::second));
+			__verified[key] = std::min(now + __verified_for, leaf.not_after().to_std_timepoint());
+		}
+	};
+
+	// Threads for the CPU-heavy part of TLS handshakes. Botan does the
+	// certificate checks, key exchange and signatures inside the handshake's
+	// read completions; with --handshake-threads those completions are bound
+	// to a strand of this pool, so a burst of new connections keeps pool
+	// threads busy instead of the io_context threads that move the bytes of
+	// running transfers. The socket stays with its io_context, which only
+	// reports readiness.
+	class crypto_pool
+	{
+	public:
+		// one handshake's strand; finished and expired are only touched on it
+		struct job
+		{
+			boost::asio::any_io_executor strand;
+			bool finished = false;
+			bool expired = false;
+		};
+	private:
+		std::optional<boost::asio::thread_pool> __pool;
+	public:
+		static uget::crypto_pool & shared()
+		{
+			static uget::crypto_pool result;
+			return result;
+		}
+	public:
+		// call once from main, before the first client; 0 is one per core
+		void start(std::size_t threads__)
+		{
+			if (threads__ == 0)
+				threads__ = std::max(std::thread::hardware_concurrency(), 1u);
+			__pool.emplace(threads__);
+		}
+		bool enabled() const
+		{
+			return __pool.has_value();
+		}
+		std::shared_ptr<job> submit()
+		{
+			return std::make_shared<job>(boost::asio::make_strand(__pool->get_executor()));
+		}
+	};
+
+	// "https" and "http" as the port numbers they stand for, anything else
+	// as is, so that what is keyed by host and port (the pool, the DNS
+	// cache, the archive, the Host header) sees one spelling of a port
+	inline std::string numeric_port(std::string_view port__)
+	{
+		if (port__ == "https")
+			return "443";
+		if (port__ == "http")
+			return "80";
+		return std::string{port__};
+	}
+
+	// The layer under HTTP, chosen at compile time: a connection or client
+	// instantiated for one transport carries nothing of the other, and the
+	// data path calls the stream directly, without virtual dispatch.
+	//
+	//	tls_transport	https://, Botan TLS over a tcp_stream
+	//	tcp_transport	http://, the tcp_stream itself
+	class tls_transport
+	{
+	public:
+		using stream_type = Botan::TLS::Stream<boost::beast::tcp_stream>;
+		static constexpr std::string_view scheme = "https";
+		static constexpr std::string_view default_port = "443";
+		static constexpr bool secure = true;
+	private:
+		std::shared_ptr<Botan::TLS::Context> __tls_context;
+	public:
+		tls_transport(
+			const std::string_view host__,
+			const std::string_view port__
+		):
+			__tls_context{
+				uget::tls_contexts::shared().context(host__, port__)
+			}
+		{
+		}
+	public:
+		stream_type stream(boost::asio::any_io_executor executor__)
+		{
+			return stream_type{__tls_context, executor__};
+		}
+		// the handshake's completions, Botan's record processing with them,
+		// run on executor__, and the awaiting coroutine resumes there
+		static boost::asio::awaitable<boost::system::error_code> handshake(
+			stream_type & stream__,
+			boost::asio::any_io_executor executor__
+		)
+		{
+			auto [ec] = co_await stream__.async_handshake(
+				Botan::TLS::Connection_Side::Client,
+				boost::asio::bind_executor(executor__, boost::asio::as_tuple(boost::asio::use_awaitable))
+			);
+			co_return ec;
+		}
+		// close_notify
+		static boost::asio::awaitable<boost::system::error_code> shutdown(stream_type & stream__)
+		{
+			auto [ec] = co_await stream__.async_shutdown(
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			co_return ec;
+		}
+	};
+
+	class tcp_transport
+	{
+	public:
+		using stream_type = boost::beast::tcp_stream;
+		static constexpr std::string_view scheme = "http";
+		static constexpr std::string_view default_port = "80";
+		static constexpr bool secure = false;
+	public:
+		tcp_transport(
+			const std::string_view,
+			const std::string_view
+		)
+		{
+		}
+	public:
+		stream_type stream(boost::asio::any_io_executor executor__)
+		{
+			return stream_type{executor__};
+		}
+		static boost::asio::awaitable<boost::system::error_code> handshake(stream_type &, boost::asio::any_io_executor)
+		{
+			co_return boost::system::error_code{};
+		}
+		// FIN after the last request, the server closes its side
+		static boost::asio::awaitable<boost::system::error_code> shutdown(stream_type & stream__)
+		{
+			boost::system::error_code ec;
+			stream__.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+			co_return ec;
+		}
+	};
+
+	// One connection, kept alive across requests.
+	// The read buffer belongs to the connection, not to the request,
+	// because bytes after one response may already be sitting in it.
+	template<class Transport>
+	class basic_connection
+	{
+	public:
+		using transport_type = Transport;
+		using stream_type = typename Transport::stream_type;
+		using clock_type = std::chrono::steady_clock;
+	private:
+		stream_type __stream;
+		boost::beast::flat_buffer __buffer;
+		clock_type::time_point __idle_since;
+		std::size_t __requests;
+	public:
+		basic_connection(
+			Transport & transport__,
+			boost::asio::any_io_executor executor__
+		):
+			__stream{transport__.stream(executor__)},
+			__buffer{},
+			__idle_since{clock_type::now()},
+			__requests{0}
+		{
+		}
+	public:
+		stream_type & stream()
+		{
+			return __stream;
+		}
+		// the tcp_stream at the bottom, for timeouts and the socket
+		boost::beast::tcp_stream & lowest()
+		{
+			return boost::beast::get_lowest_layer(__stream);
+		}
+		boost::beast::flat_buffer & buffer()
+		{
+			return __buffer;
+		}
+		std::size_t requests() const
+		{
+			return __requests;
+		}
+		clock_type::duration idle_for() const
+		{
+			return clock_type::now() - __idle_since;
+		}
+	public:
+		// called when a request on this connection has completed
+		void served()
+		{
+			++__requests;
+			__idle_since = clock_type::now();
+		}
+	public:
+		// An idle connection is only usable if the peer has said nothing.
+		// EOF means the server closed it, readable bytes mean an alert
+		// (usually close_notify) or garbage; both make it stale.
+		bool alive()
+		{
+			auto & socket = this->lowest().socket();
+			if (! socket.is_open() || __buffer.size() != 0)
+				return false;
+
+			boost::system::error_code ec;
+			char byte;
+			socket.non_blocking(true, ec);
+			if (ec)
+				return false;
+			socket.receive(
+				boost::asio::buffer(&byte, 1),
+				boost::asio::socket_base::message_peek,
+				ec
+			);
+			boost::system::error_code ignored;
+			socket.non_blocking(false, ignored);
+			return ec == boost::asio::error::would_block;
+		}
+		void close()
+		{
+			boost::system::error_code ec;
+			this->lowest().socket().close(ec);
+		}
+	};
+
+	using tls_connection = uget::basic_connection<uget::tls_transport>;
+	using tcp_connection = uget::basic_connection<uget::tcp_transport>;
+
+	// Idle keep-alive connections, per transport and (host, port).
+	// Not thread safe: a pool belongs to one io_context thread.
+	class connection_pool
+	{
+	public:
+		template<class Transport>
+		using connection_ptr = std::shared_ptr<uget::basic_connection<Transport>>;
+		using duration_type = std::chrono::steady_clock::duration;
+	private:
+		// (host, port), looked up without building a key string
+		struct key_less
+		{
+			using is_transparent = void;
+			template<class A, class B>
+			bool operator()(const A & a__, const B & b__) const
+			{
+				return std::pair<std::string_view, std::string_view>{a__.first, a__.second}
+					< std::pair<std::string_view, std::string_view>{b__.first, b__.second};
+			}
+		};
+		// An entry outlives its last idle connection while they are out, so
+		// a keep-alive loop does not rebuild it per request; it goes once it
+		// has been unused for the idle timeout.
+		template<class Transport>
+		struct entry
+		{
+			std::deque<connection_ptr<Transport>> queue;
+			std::chrono::steady_clock::time_point used;
+		};
+		template<class Transport>
+		using idle_map = std::map<
+			std::pair<std::string, std::string>,
+			entry<Transport>,
+			key_less
+		>;
+	private:
+		std::tuple<idle_map<uget::tls_transport>, idle_map<uget::tcp_transport>> __idle;
+		duration_type __idle_timeout;
+		std::size_t __max_per_host;
+	public:
+		connection_pool(
+			duration_type idle_timeout__ = std::chrono::seconds(30),
+			std::size_t max_per_host__ = 6
+		):
+			__idle{},
+			__idle_timeout{idle_timeout__},
+			__max_per_host{max_per_host__}
+		{
+		}
+	public:
+		static std::string key(const std::string_view host__, const std::string_view port__)
+		{
+			return std::string{host__} + ':' + std::string{port__};
+		}
+	public:
+		// Most recently used first: it is the one least likely to be closed.
+		// Returns nullptr when there is nothing usable for this host.
+		template<class Transport>
+		connection_ptr<Transport> acquire(const std::string_view host__, const std::string_view port__)
+		{
+			this->prune();
+			auto & idle = std::get<idle_map<Transport>>(__idle);
+			auto it = idle.find(std::pair{host__, port__});
+			if (it == idle.end())
+				return nullptr;
+
+			auto & queue = it->second.queue;
+			it->second.used = std::chrono::steady_clock::now();
+			while (! queue.empty())
+			{
+				connection_ptr<Transport> conn = std::move(queue.back());
+				queue.pop_back();
+				if (conn->alive())
+				{
+					if (uget::trace::shared().enabled())
+						std::clog << "pool: reuse connection to " << host__ << ':' << port__
+							<< " (served " << conn->requests() << " requests)" << std::endl;
+					return conn;
+				}
+				if (uget::trace::shared().enabled())
+					std::clog << "pool: drop stale connection to " << host__ << ':' << port__ << std::endl;
+				conn->close();
+			}
+			return nullptr;
+		}
+		template<class Transport>
+		void release(
+			const std::string_view host__,
+			const std::string_view port__,
+			connection_ptr<Transport> conn__
+		)
+		{
+			conn__->served();
+			auto & idle = std::get<idle_map<Transport>>(__idle);
+			auto it = idle.find(std::pair{host__, port__});
+			if (it == idle.end())
+				it = idle.try_emplace(std::pair{std::string{host__}, std::string{port__}}).first;
+			auto & queue = it->second.queue;
+			it->second.used = std::chrono::steady_clock::now();
+			queue.push_back(std::move(conn__));
+			while (queue.size() > __max_per_host)
+			{
+				queue.front()->close();
+				queue.pop_front();
+			}
+			this->prune();
+		}
+		// drop connections that have been idle longer than the timeout
+		void prune()
+		{
+			this->prune(std::get<0>(__idle));
+			this->prune(std::get<1>(__idle));
+		}
+	public:
+		// graceful close on every idle connection
+		boost::asio::awaitable<void> shutdown()
+		{
+			auto idle = std::move(__idle);
+			__idle = {};
+			co_await this->shutdown(std::get<0>(idle));
+			co_await this->shutdown(std::get<1>(idle));
+		}
+	private:
+		template<class Transport>
+		void prune(idle_map<Transport> & idle__)
+		{
+			auto now = std::chrono::steady_clock::now();
+			for (auto it = idle__.begin(); it != idle__.end();)
+			{
+				auto & queue = it->second.queue;
+				while (! queue.empty() && queue.front()->idle_for() > __idle_timeout)
+				{
+					queue.front()->close();
+					queue.pop_front();
+				}
+				if (queue.empty() && now - it->second.used > __idle_timeout)
+					it = idle__.erase(it);
+				else
+					++it;
+			}
+		}
+		template<class Transport>
+		static boost::asio::awaitable<void> shutdown(idle_map<Transport> & idle__)
+		{
+			for (auto & [name, kept]: idle__)
+			{
+				for (auto & conn: kept.queue)
+				{
+					conn->lowest().expires_after(std::chrono::seconds(2));
+					auto ec = co_await Transport::shutdown(conn->stream());
+					std::clog << "pool: closed " << Transport::scheme << "://" << name.first << ':' << name.second
+						<< ": " << ec << std::endl;
+				}
+			}
+		}
+	};
+
+	// Where a response body goes, one received chunk at a time.
+	// The reader awaits every write before reading more from the socket,
+	// so a slow sink pushes back on the connection instead of piling up
+	// memory.
+	class body_sink
+	{
+	public:
+		virtual ~body_sink()
+		{
+		}
+	public:
+		virtual boost::asio::awaitable<void> write(boost::asio::const_buffer data__) = 0;
+		virtual boost::asio::awaitable<void> close()
+		{
+			co_return;
+		}
+		// the body length, when it is known before the first write
+		virtual void expect(std::uint64_t)
+		{
+		}
+	};
+
+	class null_sink: virtual public uget::body_sink
+	{
+	public:
+		boost::asio::awaitable<void> write(boost::asio::const_buffer) override
+		{
+			co_return;
+		}
+	};
+
+	class string_sink: virtual public uget::body_sink
+	{
+	private:
+		std::string __body;
+	public:
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			__body.append(static_cast<const char *>(data__.data()), data__.size());
+			co_return;
+		}
+	public:
+		std::string & body()
+		{
+			return __body;
+		}
+	};
+
+	class ostream_sink: virtual public uget::body_sink
+	{
+	private:
+		std::ostream & __out;
+	public:
+		ostream_sink(std::ostream & out__):
+			__out{out__}
+		{
+		}
+	public:
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			__out.write(static_cast<const char *>(data__.data()), data__.size());
+			co_return;
+		}
+		boost::asio::awaitable<void> close() override
+		{
+			__out.flush();
+			co_return;
+		}
+	};
+
+	class file_sink: virtual public uget::body_sink
+	{
+	private:
+		const std::filesystem::path __path;
+		boost::beast::file __file;
+	public:
+		file_sink(
+			const std::filesystem::path & path__,
+			boost::beast::file_mode mode__ = boost::beast::file_mode::write,
+			std::uint64_t offset__ = 0
+		):
+			__path{path__},
+			__file{}
+		{
+			boost::system::error_code ec;
+			__file.open(__path.c_str(), mode__, ec);
+			if (ec)
+				throw std::system_error{ec, "can not open " + __path.string()};
+			if (offset__ != 0)
+			{
+				__file.seek(offset__, ec);
+				if (ec)
+					throw std::system_error{ec, "can not seek " + __path.string()};
+			}
+		}
+	public:
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			boost::system::error_code ec;
+			auto data = static_cast<const char *>(data__.data());
+			auto size = data__.size();
+			while (size != 0)
+			{
+				auto n = __file.write(data, size, ec);
+				if (ec)
+					throw std::system_error{ec, "write " + __path.string()};
+				data += n;
+				size -= n;
+			}
+			co_return;
+		}
+		boost::asio::awaitable<void> close() override
+		{
+			boost::system::error_code ec;
+			__file.close(ec);
+			if (ec)
+				throw std::system_error{ec, "close " + __path.string()};
+			co_return;
+		}
+	};
+
+#if defined(BOOST_ASIO_HAS_FILE)
+	// File output through asio's io_uring backed random_access_file: the
+	// loop thread only submits writes and reaps completions, the kernel does
+	// the copying and the writeback. Body data is gathered into 4 KiB aligned
+	// 1 MiB blocks, and one block is written while the next one fills. A
+	// Content-Length known up front is fallocate'd, and from direct_min on
+	// the file is switched to O_DIRECT where the filesystem allows it; the
+	// last block is then padded to the alignment and the file cut back to
+	// size. Small and unknown lengths go through the page cache.
+	class uring_file_sink: virtual public uget::body_sink
+	{
+	public:
+		// asio could not set io_uring up (an old kernel, a seccomp filter)
+		class unavailable: public std::system_error
+		{
+		public:
+			using std::system_error::system_error;
+		};
+	private:
+		static constexpr std::size_t alignment = 4096;
+		static constexpr std::size_t block_size = 1024 * 1024;
+		static constexpr std::uint64_t direct_min = 8 * block_size;
+	private:
+		struct free_block
+		{
+			void operator()(char * block__) const
+			{
+				std::free(block__);
+			}
+		};
+		using block_type = std::unique_ptr<char[], free_block>;
+		// everything a write in flight touches, kept alive by its handler
+		struct state
+		{
+			boost::asio::random_access_file file;
+			std::array<block_type, 2> blocks;
+			boost::asio::steady_timer idle;
+			bool busy;
+			boost::system::error_code error;
+		public:
+			explicit state(boost::asio::any_io_executor executor__):
+				file{executor__},
+				blocks{allocate(), allocate()},
+				idle{executor__, boost::asio::steady_timer::time_point::max()},
+				busy{false},
+				error{}
+			{
+			}
+		};
+	private:
+		const std::filesystem::path __path;
+		std::shared_ptr<state> __state;
+		bool __direct;
+		std::size_t __current;
+		std::size_t __fill;
+		std::uint64_t __offset;
+		std::uint64_t __size;
+	public:
+		uring_file_sink(
+			boost::asio::any_io_executor executor__,
+			const std::filesystem::path & path__
+		):
+			__path{path__},
+			__state{make_state(executor__)},
+			__direct{false},
+			__current{0},
+			__fill{0},
+			__offset{0},
+			__size{0}
+		{
+			int fd = ::open(__path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0)
+				throw std::system_error{errno, std::generic_category(), "can not open " + __path.string()};
+			__state->file.assign(fd);
+		}
+	public:
+		void expect(std::uint64_t length__) override
+		{
+			if (length__ == 0 || __offset != 0 || __fill != 0)
+				return;
+			int fd = __state->file.native_handle();
+			if (::fallocate(fd, 0, 0, static_cast<off_t>(length__)) != 0)
+			{
+				// a filesystem without it says so for every file, once is enough
+				static std::atomic_flag told = ATOMIC_FLAG_INIT;
+				if (! told.test_and_set())
+					std::clog << "fallocate " << __path << ": " << std::strerror(errno) << std::endl;
+			}
+			if (length__ >= direct_min)
+			{
+				int flags = ::fcntl(fd, F_GETFL);
+				__direct = flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+			}
+		}
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			auto data = static_cast<const char *>(data__.data());
+			auto size = data__.size();
+			while (size != 0)
+			{
+				auto n = std::min(size, block_size - __fill);
+				std::memcpy(__state->blocks[__current].get() + __fill, data, n);
+				__fill += n;
+				data += n;
+				size -= n;
+				if (__fill == block_size)
+					co_await this->submit(block_size);
+			}
+			__size += data__.size();
+		}
+		boost::asio::awaitable<void> close() override
+		{
+			if (__fill != 0)
+			{
+				auto size = __fill;
+				if (__direct)
+				{
+					size = (__fill + alignment - 1) / alignment * alignment;
+					std::memset(__state->blocks[__current].get() + __fill, 0, size - __fill);
+				}
+				co_await this->submit(size);
+			}
+			co_await this->drain();
+
+			boost::system::error_code ec;
+			__state->file.resize(__size, ec);
+			if (! ec)
+				__state->file.close(ec);
+			if (ec)
+				throw std::system_error{ec, "close " + __path.string()};
+		}
+	private:
+		// waits for the other block to be written, then writes this one
+		boost::asio::awaitable<void> submit(std::size_t size__)
+		{
+			co_await this->drain();
+			__state->busy = true;
+			boost::asio::async_write_at(
+				__state->file,
+				__offset,
+				boost::asio::buffer(__state->blocks[__current].get(), size__),
+				[state = __state] (boost::system::error_code ec, std::size_t)
+				{
+					state->busy = false;
+					state->error = ec;
+					state->idle.cancel();
+				}
+			);
+			__offset += size__;
+			__current ^= 1;
+			__fill = 0;
+		}
+		boost::asio::awaitable<void> drain()
+		{
+			while (__state->busy)
+				co_await __state->idle.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+			if (__state->error)
+				throw std::system_error{__state->error, "write " + __path.string()};
+		}
+		static std::shared_ptr<state> make_state(boost::asio::any_io_executor executor__)
+		{
+			try
+			{
+				return std::make_shared<state>(executor__);
+			}
+			catch (const boost::system::system_error & e)
+			{
+				throw unavailable{e.code(), e.what()};
+			}
+		}
+		static block_type allocate()
+		{
+			auto block = static_cast<char *>(std::aligned_alloc(alignment, block_size));
+			if (! block)
+				throw std::bad_alloc{};
+			return block_type{block};
+		}
+	};
+#endif
+
+	// a whole body into a new file, through io_uring when asio has it and
+	// the kernel lets us set it up, else with plain writes
+	inline std::unique_ptr<uget::body_sink> make_file_sink(
+		[[maybe_unused]] boost::asio::any_io_executor executor__,
+		const std::filesystem::path & path__
+	)
+	{
+#if defined(BOOST_ASIO_HAS_FILE)
+		static std::atomic<bool> uring{true};
+		if (uring.load(std::memory_order_relaxed))
+		{
+			try
+			{
+				return std::make_unique<uget::uring_file_sink>(executor__, path__);
+			}
+			catch (const uget::uring_file_sink::unavailable & e)
+			{
+				if (uring.exchange(false))
+					std::clog << "io_uring: " << e.what() << ", writing files without it" << std::endl;
+			}
+		}
+#endif
+		return std::make_unique<uget::file_sink>(path__);
+	}
+
+	// gzip, zlib-wrapped deflate and, from broken servers, raw deflate.
+	// Output goes downstream one bounded block at a time, so a small
+	// compressed chunk that expands a lot never sits in memory whole.
+	class inflate_sink: virtual public uget::body_sink
+	{
+	private:
+		static constexpr std::size_t block_size = 64 * 1024;
+	private:
+		uget::body_sink & __next;
+		const bool __deflate;
+		z_stream __stream;
+		std::unique_ptr<char[]> __block;
+		bool __first;
+		bool __end;
+	public:
+		inflate_sink(uget::body_sink & next__, bool deflate__):
+			__next{next__},
+			__deflate{deflate__},
+			__stream{},
+			__block{std::make_unique<char[]>(block_size)},
+			__first{true},
+			__end{false}
+		{
+			// 15 + 32: zlib or gzip header, detected automatically
+			if (inflateInit2(&__stream, 15 + 32) != Z_OK)
+				throw std::runtime_error{"inflateInit2 failed"};
+		}
+		virtual ~inflate_sink()
+		{
+			inflateEnd(&__stream);
+		}
+	public:
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			auto input = const_cast<Bytef *>(static_cast<const Bytef *>(data__.data()));
+			__stream.next_in = input;
+			__stream.avail_in = static_cast<uInt>(data__.size());
+			for (;;)
+			{
+				__stream.next_out = reinterpret_cast<Bytef *>(__block.get());
+				__stream.avail_out = static_cast<uInt>(block_size);
+				int ret = inflate(&__stream, Z_NO_FLUSH);
+				if (ret == Z_DATA_ERROR && __deflate && __first && __stream.total_out == 0)
+				{
+					// "deflate" without the zlib wrapper
+					inflateEnd(&__stream);
+					__stream = {};
+					if (inflateInit2(&__stream, -15) != Z_OK)
+						throw std::runtime_error{"inflateInit2 failed"};
+					__stream.next_in = input;
+					__stream.avail_in = static_cast<uInt>(data__.size());
+					__first = false;
+					continue;
+				}
+				if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+					throw std::runtime_error{"inflate error: "s + (__stream.msg ? __stream.msg : "unknown")};
+
+				std::size_t produced = block_size - __stream.avail_out;
+				if (produced != 0)
+					co_await __next.write(boost::asio::const_buffer{__block.get(), produced});
+
+				if (ret == Z_STREAM_END)
+				{
+					__end = true;
+					if (__stream.avail_in == 0)
+						break;
+					// another gzip member follows
+					inflateReset(&__stream);
+					__end = false;
+					continue;
+				}
+				if (__stream.avail_in == 0 && __stream.avail_out != 0)
+					break;
+				if (ret == Z_BUF_ERROR && produced == 0)
+					break;
+			}
+			__first = false;
+		}
+		boost::asio::awaitable<void> close() override
+		{
+			if (! __end)
+				throw std::runtime_error{"compressed body is truncated"};
+			co_await __next.close();
+		}
+	};
+
+	class brotli_sink: virtual public uget::body_sink
+	{
+	private:
+		static constexpr std::size_t block_size = 64 * 1024;
+	private:
+		uget::body_sink & __next;
+		BrotliDecoderState * __state;
+		std::unique_ptr<std::uint8_t[]> __block;
+		bool __end;
+	public:
+		brotli_sink(uget::body_sink & next__):
+			__next{next__},
+			__state{BrotliDecoderCreateInstance(nullptr, nullptr, nullptr)},
+			__block{std::make_unique<std::uint8_t[]>(block_size)},
+			__end{false}
+		{
+			if (! __state)
+				throw std::runtime_error{"BrotliDecoderCreateInstance failed"};
+		}
+		virtual ~brotli_sink()
+		{
+			BrotliDecoderDestroyInstance(__state);
+		}
+	public:
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			auto next_in = static_cast<const std::uint8_t *>(data__.data());
+			std::size_t avail_in = data__.size();
+			for (;;)
+			{
+				std::uint8_t * next_out = __block.get();
+				std::size_t avail_out = block_size;
+				auto result = BrotliDecoderDecompressStream(
+					__state,
+					&avail_in,
+					&next_in,
+					&avail_out,
+					&next_out,
+					nullptr
+				);
+				if (result == BROTLI_DECODER_RESULT_ERROR)
+					throw std::runtime_error{"brotli error: "s
+						+ BrotliDecoderErrorString(BrotliDecoderGetErrorCode(__state))};
+
+				std::size_t produced = block_size - avail_out;
+				if (produced != 0)
+					co_await __next.write(boost::asio::const_buffer{__block.get(), produced});
+
+				if (result == BROTLI_DECODER_RESULT_SUCCESS)
+				{
+					__end = true;
+					break;
+				}
+				if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT)
+					break;
+			}
+		}
+		boost::asio::awaitable<void> close() override
+		{
+			if (! __end)
+				throw std::runtime_error{"compressed body is truncated"};
+			co_await __next.close();
+		}
+	};
+
+	// nullptr when the body is not encoded, or not in a way we know
+	inline std::unique_ptr<uget::body_sink> make_decoder(
+		std::string_view encoding__,
+		uget::body_sink & next__
+	)
+	{
+		std::string encoding{encoding__};
+		std::ranges::transform(
+			encoding,
+			encoding.begin(),
+			[] (unsigned char c)
+			{
+				return std::tolower(c);
+			}
+		);
+		if (encoding.empty() || encoding == "identity")
+			return nullptr;
+		if (encoding == "gzip" || encoding == "x-gzip")
+			return std::make_unique<uget::inflate_sink>(next__, false);
+		if (encoding == "deflate")
+			return std::make_unique<uget::inflate_sink>(next__, true);
+		if (encoding == "br")
+			return std::make_unique<uget::brotli_sink>(next__);
+		std::clog << "unknown Content-Encoding \"" << encoding << "\", body is kept as is" << std::endl;
+		return nullptr;
+	}
+
+	// A file mapped read-only; an empty file maps to nothing.
+	class mapped_file
+	{
+	private:
+		void * __data;
+		std::size_t __size;
+	public:
+		explicit mapped_file(const std::filesystem::path & path__):
+			__data{nullptr},
+			__size{0}
+		{
+			int fd = ::open(path__.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				throw std::system_error{errno, std::generic_category(), "open " + path__.string()};
+			struct ::stat st{};
+			if (::fstat(fd, & st) == 0 && st.st_size > 0)
+			{
+				__size = static_cast<std::size_t>(st.st_size);
+				__data = ::mmap(nullptr, __size, PROT_READ, MAP_PRIVATE, fd, 0);
+			}
+			int error = errno;
+			::close(fd);
+			if (__data == MAP_FAILED)
+			{
+				__data = nullptr;
+				throw std::system_error{error, std::generic_category(), "mmap " + path__.string()};
+			}
+			if (__data)
+				::madvise(__data, __size, MADV_SEQUENTIAL);
+		}
+		mapped_file(const mapped_file &) = delete;
+		mapped_file & operator=(const mapped_file &) = delete;
+		~mapped_file()
+		{
+			if (__data)
+				::munmap(__data, __size);
+		}
+	public:
+		const char * data() const
+		{
+			return static_cast<const char *>(__data);
+		}
+		std::size_t size() const
+		{
+			return __size;
+		}
+	};
+
+	// Botan's name for a --hash spelling:
+	// sha256, sha512, blake2b, blake2b-256, or a Botan name as is.
+	inline std::string hash_name(std::string_view name__)
+	{
+		std::string name{name__};
+		std::ranges::transform(
+			name,
+			name.begin(),
+			[] (unsigned char c)
+			{
+				return std::tolower(c);
+			}
+		);
+		if (name == "sha1" || name == "sha256" || name == "sha384" || name == "sha512")
+			return "SHA-" + name.substr(3);
+		if (name == "blake2b")
+			return "BLAKE2b(512)";
+		if (name.starts_with("blake2b-"))
+			return "BLAKE2b(" + name.substr(8) + ")";
+		return std::string{name__};
+	}
+
+	// Digests of a body taken as it streams into next__, so checking a
+	// download costs no second read of the file. The digests are there
+	// after close(), lowercase hex by Botan name.
+	class hash_sink: virtual public uget::body_sink
+	{
+	private:
+		uget::body_sink & __next;
+		std::vector<std::pair<std::string, std::unique_ptr<Botan::HashFunction>>> __hashes;
+		std::map<std::string, std::string, std::less<>> __digests;
+	public:
+		hash_sink(uget::body_sink & next__, const std::vector<std::string> & algorithms__):
+			__next{next__},
+			__hashes{},
+			__digests{}
+		{
+			for (const auto & algorithm: algorithms__)
+				__hashes.emplace_back(algorithm, Botan::HashFunction::create_or_throw(algorithm));
+		}
+	public:
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			for (auto & [name, hash]: __hashes)
+				hash->update(static_cast<const std::uint8_t *>(data__.data()), data__.size());
+			co_await __next.write(data__);
+		}
+		boost::asio::awaitable<void> close() override
+		{
+			for (auto & [name, hash]: __hashes)
+				__digests[name] = Botan::hex_encode(hash->final(), false);
+			co_await __next.close();
+		}
+		void expect(std::uint64_t length__) override
+		{
+			__next.expect(length__);
+		}
+	public:
+		const std::map<std::string, std::string, std::less<>> & digests() const
+		{
+			return __digests;
+		}
+	};
+
+	// The same digests for a file already on disk, for downloads whose
+	// bytes do not arrive in order (segmented).
+	inline std::map<std::string, std::string, std::less<>> hash_file(
+		const std::filesystem::path & path__,
+		const std::vector<std::string> & algorithms__
+	)
+	{
+		uget::mapped_file file{path__};
+		std::map<std::string, std::string, std::less<>> result;
+		for (const auto & algorithm: algorithms__)
+		{
+			auto hash = Botan::HashFunction::create_or_throw(algorithm);
+			hash->update(reinterpret_cast<const std::uint8_t *>(file.data()), file.size());
+			result[algorithm] = Botan::hex_encode(hash->final(), false);
+		}
+		return result;
+	}
+
+	// What to hash, what the digests must be, and where they are listed.
+	// The manifest takes one "SHA256 (path) = hex" line per file and
+	// algorithm, the BSD tag format that `sha256sum -c` and `b2sum -c` read.
+	class integrity
+	{
+	private:
+		std::vector<std::string> __algorithms;
+		std::mutex __mutex;
+		std::ofstream __manifest;
+	public:
+		static uget::integrity & shared()
+		{
+			static uget::integrity result;
+			return result;
+		}
+	public:
+		// "sha256,blake2b"
+		void algorithms(std::string_view list__)
+		{
+			__algorithms.clear();
+			while (! list__.empty())
+			{
+				auto comma = list__.find(',');
+				if (auto item = list__.substr(0, comma); ! item.empty())
+					this->require(uget::hash_name(item));
+				list__ = comma == std::string_view::npos ? "" : list__.substr(comma + 1);
+			}
+		}
+		void require(const std::string & algorithm__)
+		{
+			if (std::ranges::find(__algorithms, algorithm__) != __algorithms.end())
+				return;
+			Botan::HashFunction::create_or_throw(algorithm__);
+			__algorithms.push_back(algorithm__);
+		}
+		const std::vector<std::string> & algorithms() const
+		{
+			return __algorithms;
+		}
+		void manifest(const std::filesystem::path & path__)
+		{
+			__manifest.open(path__, std::ios::app);
+			if (! __manifest)
+				throw std::runtime_error{"can not open " + path__.string()};
+		}
+		bool enabled() const
+		{
+			return __manifest.is_open();
+		}
+	public:
+		// adds to the manifest; false, with a message, when expected__ is
+		// given and the algorithm__ digest is not it
+		bool check(
+			const std::string & name__,
+			const std::map<std::string, std::string, std::less<>> & digests__,
+			std::string_view algorithm__ = {},
+			std::string_view expected__ = {}
+		)
+		{
+			if (__manifest.is_open())
+			{
+				std::lock_guard lock{__mutex};
+				for (const auto & [algorithm, digest]: digests__)
+					__manifest << tag(algorithm) << " (" << name__ << ") = " << digest << '\n';
+				__manifest.flush();
+			}
+			if (expected__.empty())
+				return true;
+			auto found = digests__.find(algorithm__);
+			if (found != digests__.end() && boost::beast::iequals(found->second, expected__))
+				return true;
+			std::clog << name__ << ": " << algorithm__ << " mismatch, expected " << expected__
+				<< ", got " << (found == digests__.end() ? "nothing"s : found->second) << std::endl;
+			return false;
+		}
+	private:
+		// SHA-256 -> SHA256, BLAKE2b(512) -> BLAKE2b, BLAKE2b(256) -> BLAKE2b-256
+		static std::string tag(std::string_view algorithm__)
+		{
+			if (algorithm__.starts_with("SHA-"))
+				return "SHA"s + std::string{algorithm__.substr(4)};
+			if (algorithm__ == "BLAKE2b(512)")
+				return "BLAKE2b";
+			if (algorithm__.starts_with("BLAKE2b(") && algorithm__.ends_with(")"))
+				return "BLAKE2b-"s + std::string{algorithm__.substr(8, algorithm__.size() - 9)};
+			return std::string{algorithm__};
+		}
+	};
+
+	// Responses by url under cache_dir()/http: <key>.body holds the body as
+	// the sink got it (decoded), <key>.meta the url, when it was stored and
+	// the response header. A fresh entry is served from a mapping of the body
+	// file without touching the network; a stale one is revalidated with
+	// If-None-Match / If-Modified-Since and served the same way on 304.
+	// Freshness follows Cache-Control (no-store, no-cache, max-age), then
+	// Expires, then a tenth of the Last-Modified age, capped at a day.
+	class http_cache
+	{
+	public:
+		struct entry
+		{
+			std::filesystem::path body;
+			std::filesystem::path meta;
+			std::string url;
+			std::chrono::system_clock::time_point stored;
+			std::uint64_t size = 0;
+			boost::beast::http::fields header;
+		public:
+			bool fresh() const
+			{
+				auto age = std::chrono::system_clock::now() - stored + http_cache::age(header);
+				return age < http_cache::lifetime(header);
+			}
+		};
+	private:
+		static constexpr std::string_view magic = "uget-cache-1";
+		static constexpr std::size_t serve_block = 1024 * 1024;
+	private:
+		std::filesystem::path __dir;
+		std::atomic<std::uint64_t> __sequence{0};
+	public:
+		static uget::http_cache & shared()
+		{
+			static uget::http_cache cache;
+			return cache;
+		}
+	public:
+		void open(const std::filesystem::path & dir__)
+		{
+			std::filesystem::create_directories(dir__);
+			__dir = dir__;
+		}
+		bool enabled() const
+		{
+			return ! __dir.empty();
+		}
+	public:
+		std::optional<entry> find(const std::string & url__) const
+		{
+			auto [body, meta] = this->paths(url__);
+			std::ifstream in{meta};
+			std::string line;
+			if (! std::getline(in, line) || line != magic)
+				return std::nullopt;
+
+			entry result;
+			result.body = body;
+			result.meta = meta;
+			long long stored = 0;
+			if (! std::getline(in, result.url) || result.url != url__ || ! (in >> stored >> result.size))
+				return std::nullopt;
+			result.stored = std::chrono::system_clock::time_point{std::chrono::seconds(stored)};
+			std::getline(in, line);
+			while (std::getline(in, line))
+			{
+				auto colon = line.find(": ");
+				if (colon != std::string::npos)
+					result.header.insert(line.substr(0, colon), line.substr(colon + 2));
+			}
+
+			// a body rewritten under a meta it does not belong to is a miss
+			std::error_code ec;
+			if (std::filesystem::file_size(body, ec) != result.size || ec)
+				return std::nullopt;
+			return result;
+		}
+		// A sink that passes the body on to next__ and keeps a copy; the entry
+		// replaces the old one when the body is complete. nullptr when the
+		// response may not be stored.
+		template<class Fields>
+		std::unique_ptr<uget::body_sink> store(
+			const std::string & url__,
+			const boost::beast::http::response_header<Fields> & header__,
+			uget::body_sink & next__
+		);
+		// 304: the validators and freshness of the new header, the stored body
+		template<class Fields>
+		void refresh(entry & entry__, const boost::beast::http::response_header<Fields> & header__)
+		{
+			for (auto field: {
+				boost::beast::http::field::etag,
+				boost::beast::http::field::last_modified,
+				boost::beast::http::field::cache_control,
+				boost::beast::http::field::expires,
+				boost::beast::http::field::date,
+				boost::beast::http::field::age
+			})
+			{
+				auto value = header__.find(field);
+				if (value != header__.end())
+					entry__.header.set(field, value->value());
+				else if (field == boost::beast::http::field::age)
+					entry__.header.erase(field);
+			}
+			entry__.stored = std::chrono::system_clock::now();
+			this->write_meta(entry__);
+		}
+		static boost::asio::awaitable<std::size_t> serve(const entry & entry__, uget::body_sink & sink__)
+		{
+			uget::mapped_file file{entry__.body};
+			for (std::size_t offset = 0; offset < file.size(); offset += serve_block)
+			{
+				co_await sink__.write(boost::asio::const_buffer{
+					file.data() + offset,
+					std::min(serve_block, file.size() - offset)
+				});
+			}
+			co_await sink__.close();
+			co_return file.size();
+		}
+	public:
+		static std::optional<std::chrono::system_clock::time_point> parse_date(std::string_view text__)
+		{
+			std::tm tm{};
+			std::istringstream in{std::string{text__}};
+			in.imbue(std::locale::classic());
+			in >> std::get_time(& tm, "%a, %d %b %Y %H:%M:%S");
+			if (in.fail())
+				return std::nullopt;
+			return std::chrono::system_clock::from_time_t(::timegm(& tm));
+		}
+	private:
+		static std::chrono::seconds age(const boost::beast::http::fields & header__)
+		{
+			auto value = header__[boost::beast::http::field::age];
+			long long seconds = 0;
+			std::from_chars(value.data(), value.data() + value.size(), seconds);
+			return std::chrono::seconds(std::max(seconds, 0LL));
+		}
+		static std::chrono::system_clock::duration lifetime(const boost::beast::http::fields & header__)
+		{
+			auto control = directives(header__[boost::beast::http::field::cache_control]);
+			if (control.contains("no-cache") || control.contains("no-store"))
+				return {};
+			if (auto max_age = control.find("max-age"); max_age != control.end())
+			{
+				long long seconds = 0;
+				auto & value = max_age->second;
+				std::from_chars(value.data(), value.data() + value.size(), seconds);
+				return std::chrono::seconds(std::max(seconds, 0LL));
+			}
+
+			auto date = parse_date(header__[boost::beast::http::field::date]);
+			if (! date)
+				return {};
+			if (auto expires = parse_date(header__[boost::beast::http::field::expires]))
+				return * expires - * date;
+			if (auto modified = parse_date(header__[boost::beast::http::field::last_modified]))
+				return std::min<std::chrono::system_clock::duration>((* date - * modified) / 10, std::chrono::hours(24));
+			return {};
+		}
+		static std::map<std::string, std::string> directives(std::string_view text__)
+		{
+			std::map<std::string, std::string> result;
+			while (! text__.empty())
+			{
+				auto comma = text__.find(',');
+				auto item = text__.substr(0, comma);
+				text__.remove_prefix(comma == std::string_view::npos ? text__.size() : comma + 1);
+
+				auto first = item.find_first_not_of(" \t");
+				if (first == std::string_view::npos)
+					continue;
+				item = item.substr(first, item.find_last_not_of(" \t") - first + 1);
+				auto equal = item.find('=');
+				std::string name{item.substr(0, equal)};
+				for (auto & c: name)
+					c = std::tolower(static_cast<unsigned char>(c));
+				std::string value;
+				if (equal != std::string_view::npos)
+					value = item.substr(equal + 1);
+				std::erase(value, '"');
+				result[name] = value;
+			}
+			return result;
+		}
+	private:
+		std::pair<std::filesystem::path, std::filesystem::path> paths(const std::string & url__) const
+		{
+			auto hash = Botan::HashFunction::create_or_throw("SHA-256");
+			auto key = Botan::hex_encode(hash->process(url__), false);
+			return {__dir / (key + ".body"), __dir / (key + ".meta")};
+		}
+		std::filesystem::path temporary(const std::filesystem::path & path__)
+		{
+			return path__.string() + ".tmp." + std::to_string(::getpid()) + '.'
+				+ std::to_string(__sequence.fetch_add(1, std::memory_order_relaxed));
+		}
+		void write_meta(const entry & entry__)
+		{
+			// a name of its own: two clients may refresh the same key at once
+			auto tmp = this->temporary(entry__.meta);
+			{
+				std::ofstream out{tmp, std::ios::trunc};
+				out << magic << '\n' << entry__.url << '\n'
+					<< std::chrono::duration_cast<std::chrono::seconds>(entry__.stored.time_since_epoch()).count()
+					<< ' ' << entry__.size << '\n';
+				for (const auto & field: entry__.header)
+					out << field.name_string() << ": " << field.value() << '\n';
+				if (! out)
+					return;
+			}
+			std::error_code ec;
+			std::filesystem::rename(tmp, entry__.meta, ec);
+			if (ec)
+				std::filesystem::remove(tmp, ec);
+		}
+	private:
+		class writer;
+	};
+
+	class http_cache::writer: virtual public uget::body_sink
+	{
+	private:
+		uget::http_cache & __cache;
+		uget::http_cache::entry __entry;
+		const std::filesystem::path __tmp;
+		std::ofstream __out;
+		bool __committed;
+		uget::body_sink & __next;
+	public:
+		writer(
+			uget::http_cache & cache__,
+			uget::http_cache::entry entry__,
+			std::filesystem::path tmp__,
+			uget::body_sink & next__
+		):
+			__cache{cache__},
+			__entry{std::move(entry__)},
+			__tmp{std::move(tmp__)},
+			__out{__tmp, std::ios::binary | std::ios::trunc},
+			__committed{false},
+			__next{next__}
+		{
+		}
+		~writer()
+		{
+			if (__committed)
+				return;
+			__out.close();
+			std::error_code ec;
+			std::filesystem::remove(__tmp, ec);
+		}
+	public:
+		// a full disk costs the cache entry, not the download
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			if (__out)
+			{
+				__out.write(static_cast<const char *>(data__.data()), data__.size());
+				__entry.size += data__.size();
+			}
+			co_await __next.write(data__);
+		}
+		boost::asio::awaitable<void> close() override
+		{
+			co_await __next.close();
+			__out.close();
+			if (! __out)
+				co_return;
+			std::error_code ec;
+			std::filesystem::rename(__tmp, __entry.body, ec);
+			if (ec)
+				co_return;
+			__committed = true;
+			__cache.write_meta(__entry);
+		}
+	};
+
+	template<class Fields>
+	std::unique_ptr<uget::body_sink> uget::http_cache::store(
+		const std::string & url__,
+		const boost::beast::http::response_header<Fields> & header__,
+		uget::body_sink & next__
+	)
+	{
+		if (header__.result() != boost::beast::http::status::ok)
+			return nullptr;
+		if (directives(header__[boost::beast::http::field::cache_control]).contains("no-store"))
+			return nullptr;
+		// the body is kept decoded, so a Vary on anything but the encoding can not be honoured
+		auto vary = header__[boost::beast::http::field::vary];
+		if (! vary.empty() && ! boost::beast::iequals(vary, "accept-encoding"))
+			return nullptr;
+
+		entry result;
+		std::tie(result.body, result.meta) = this->paths(url__);
+		result.url = url__;
+		result.stored = std::chrono::system_clock::now();
+		for (const auto & field: header__)
+		{
+			switch (field.name())
+			{
+			// they describe the bytes on the wire, not the stored body
+			case boost::beast::http::field::content_length:
+			case boost::beast::http::field::content_encoding:
+			case boost::beast::http::field::transfer_encoding:
+			case boost::beast::http::field::connection:
+			case boost::beast::http::field::keep_alive:
+				break;
+			default:
+				result.header.insert(field.name_string(), field.value());
+			}
+		}
+		auto has_validator = result.header.count(boost::beast::http::field::etag) != 0
+			|| result.header.count(boost::beast::http::field::last_modified) != 0;
+		if (! has_validator && lifetime(result.header) <= std::chrono::system_clock::duration::zero())
+			return nullptr;
+
+		auto tmp = this->temporary(result.body);
+		return std::make_unique<uget::http_cache::writer>(* this, std::move(result), std::move(tmp), next__);
+	}
+
+	// --record: request/response pairs as they came over the wire, to be
+	// served again by replay_server. The file is append-only, a
+	// "uget-archive-1" line and then, per response,
+	//
+	//	@ <method> <url> <range or -> <first byte us> <transfer us> <header bytes> <body bytes>
+	//	<response header><body>
+	//
+	// where the body is as received: still content-encoded, but no longer
+	// chunked. A body is spooled to a temporary file beside the archive
+	// until it is complete and then copied in one piece, so concurrent
+	// requests never interleave and a large body is never held in memory.
+	class archive
+	{
+	public:
+		static constexpr std::string_view magic = "uget-archive-1\n";
+	private:
+		class recorder: virtual public uget::body_sink
+		{
+		private:
+			uget::archive & __archive;
+			uget::body_sink & __next;
+			std::string __head;
+			std::string __header;
+			std::chrono::steady_clock::duration __first_byte;
+			std::chrono::steady_clock::time_point __begin;
+			const std::filesystem::path __spool;
+			std::ofstream __body;
+			std::uint64_t __size;
+		public:
+			recorder(
+				uget::archive & archive__,
+				std::string head__,
+				std::string header__,
+				std::chrono::steady_clock::duration first_byte__,
+				uget::body_sink & next__
+			):
+				__archive{archive__},
+				__next{next__},
+				__head{std::move(head__)},
+				__header{std::move(header__)},
+				__first_byte{first_byte__},
+				__begin{std::chrono::steady_clock::now()},
+				__spool{archive__.temporary()},
+				__body{__spool, std::ios::binary | std::ios::trunc},
+				__size{0}
+			{
+			}
+			~recorder()
+			{
+				__body.close();
+				std::error_code ec;
+				std::filesystem::remove(__spool, ec);
+			}
+		public:
+			// a full disk costs the record, not the download
+			boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+			{
+				if (__body)
+				{
+					__body.write(static_cast<const char *>(data__.data()), data__.size());
+					__size += data__.size();
+				}
+				co_await __next.write(data__);
+			}
+			// a body the next sink rejects (truncated, ...) is not recorded
+			boost::asio::awaitable<void> close() override
+			{
+				co_await __next.close();
+				__body.close();
+				if (! __body)
+				{
+					std::clog << "record: can not spool " << __head << ", not recorded" << std::endl;
+					co_return;
+				}
+				__archive.append(__head, __first_byte, std::chrono::steady_clock::now() - __begin, __header, __spool, __size);
+			}
+			void expect(std::uint64_t length__) override
+			{
+				__next.expect(length__);
+			}
+		};
+	private:
+		std::mutex __mutex;
+		std::ofstream __out;
+		std::filesystem::path __path;
+		std::atomic<std::uint64_t> __sequence{0};
+		std::atomic<bool> __recording{false};
+	public:
+		static uget::archive & shared()
+		{
+			static uget::archive result;
+			return result;
+		}
+	public:
+		void open(const std::filesystem::path & path__)
+		{
+			std::error_code ec;
+			bool fresh = ! std::filesystem::exists(path__, ec) || std::filesystem::file_size(path__, ec) == 0;
+			__out.open(path__, std::ios::binary | std::ios::app);
+			if (! __out)
+				throw std::runtime_error{"can not open " + path__.string()};
+			// tellp() is where a record starts, append() cuts a failed one off there
+			__out.seekp(0, std::ios::end);
+			__path = path__;
+			if (fresh)
+				__out << magic << std::flush;
+			__recording = true;
+		}
+		// false again once the archive could not be written
+		bool recording() const
+		{
+			return __recording.load(std::memory_order_relaxed);
+		}
+		// a Range value as one word, "-" for none
+		static std::string range(std::string_view range__)
+		{
+			std::string result;
+			std::ranges::copy_if(range__, std::back_inserter(result), [] (char c) { return c != ' ' && c != '\t'; });
+			return result.empty() ? "-" : result;
+		}
+		// head__ is "<method> <url> <range or ->", header__ the response
+		// header as sent; the returned sink goes in front of next__
+		std::unique_ptr<uget::body_sink> record(
+			std::string head__,
+			std::string header__,
+			std::chrono::steady_clock::duration first_byte__,
+			uget::body_sink & next__
+		)
+		{
+			return std::make_unique<recorder>(* this, std::move(head__), std::move(header__), first_byte__, next__);
+		}
+	private:
+		// beside the archive, so the copy into it stays on one file system
+		std::filesystem::path temporary()
+		{
+			return __path.string() + ".tmp." + std::to_string(::getpid()) + '.'
+				+ std::to_string(__sequence.fetch_add(1, std::memory_order_relaxed));
+		}
+		// A record that can not be written whole is cut off again and ends
+		// the recording; the download it belongs to carries on.
+		void append(
+			std::string_view head__,
+			std::chrono::steady_clock::duration first_byte__,
+			std::chrono::steady_clock::duration transfer__,
+			std::string_view header__,
+			const std::filesystem::path & body__,
+			std::uint64_t size__
+		)
+		{
+			using std::chrono::duration_cast;
+			using std::chrono::microseconds;
+			std::ifstream body{body__, std::ios::binary};
+			std::unique_lock lock{__mutex};
+			if (! __recording.load(std::memory_order_relaxed))
+				return;
+			auto start = __out.tellp();
+			__out << "@ " << head__
+				<< ' ' << duration_cast<microseconds>(first_byte__).count()
+				<< ' ' << duration_cast<microseconds>(transfer__).count()
+				<< ' ' << header__.size() << ' ' << size__ << '\n'
+				<< header__;
+			std::array<char, 64 * 1024> block;
+			for (auto left = size__; left != 0 && body;)
+			{
+				auto n = std::min<std::uint64_t>(left, block.size());
+				body.read(block.data(), static_cast<std::streamsize>(n));
+				__out.write(block.data(), body.gcount());
+				left -= body.gcount();
+			}
+			__out << std::flush;
+			if (__out && body)
+				return;
+
+			std::clog << "record: can not write " << __path << ", recording stopped" << std::endl;
+			__recording = false;
+			__out.close();
+			std::error_code ec;
+			if (start >= 0)
+				std::filesystem::resize_file(__path, static_cast<std::uintmax_t>(std::streamoff{start}), ec);
+		}
+	};
+
+	// One request, over Transport (tls_transport or tcp_transport).
+	template<class Transport>
+	class basic_client: virtual public std::enable_shared_from_this<uget::basic_client<Transport>>
+	{
+	public:
+		using transport_type = Transport;
+		using connection_type = uget::basic_connection<Transport>;
+		using connection_ptr = uget::connection_pool::connection_ptr<Transport>;
+		// header fields come from the thread's block_pool, so a warmed up
+		// request loop does not allocate for them
+		using fields_type = boost::beast::http::basic_fields<uget::recycling_allocator<char>>;
+		using request_type = boost::beast::http::request<boost::beast::http::empty_body, fields_type>;
+		using response_parser = boost::beast::http::response_parser<boost::beast::http::buffer_body, uget::recycling_allocator<char>>;
+		// the most body data held in memory per request
+		static constexpr std::size_t chunk_size = 64 * 1024;
+	private:
+		const std::string __host;
+		const std::string __port;
+		const std::string __uri;
+		const std::string __authority;
+	private:
+		boost::asio::ip::tcp::resolver __resolver;
+	private:
+		Transport __transport;
+	private:
+		boost::asio::any_io_executor __executor;
+		uget::connection_pool & __pool;
+		connection_ptr __connection;
+	private:
+		request_type __request;
+		std::optional<response_parser> __parser;
+		uget::pooled_buffer __chunk;
+		std::size_t __body_bytes;
+		bool __complete;
+		bool __decode;
+		bool __reused;
+		bool __cancelled;
+		std::shared_ptr<uget::crypto_pool::job> __offloaded;
+		std::shared_ptr<uget::connect_race> __race;
+		boost::asio::steady_timer __backoff;
+	private:
+		bool __cacheable;
+		std::optional<uget::http_cache::entry> __cached;
+		bool __cache_hit;
+	private:
+		uget::retry_policy __policy;
+		std::chrono::steady_clock::time_point __deadline;
+		std::chrono::steady_clock::time_point __sent;
+	private:
+		uget::net_monitor::signal_type __signal;
+		uget::net_monitor & __monitor;
+	public:
+		virtual ~basic_client()
+		{
+			this->signal("client destructor is called");
+		}
+	public:
+		basic_client(
+			const std::string_view host__,
+			const std::string_view port__,
+			const std::string_view uri__,
+			boost::asio::any_io_executor executor__,
+			uget::connection_pool & pool__,
+			uget::net_monitor & monitor__
+		):
+			__host{host__},
+			__port{uget::numeric_port(port__)},
+			__uri{uri__},
+			__authority{authority(__host, __port)},
+
+			__resolver{executor__},
+
+			__transport{host__, port__},
+
+			__executor{executor__},
+			__pool{pool__},
+			__connection{},
+
+			__request{},
+			__parser{},
+			__chunk{},
+			__body_bytes{0},
+			__complete{false},
+			__decode{true},
+			__reused{false},
+			__cancelled{false},
+			__offloaded{},
+			__race{},
+			__backoff{executor__},
+
+			__cacheable{true},
+			__cached{},
+			__cache_hit{false},
+
+			__policy{uget::policy_registry::shared().find(host__)},
+			__deadline{},
+			__sent{},
+
+			__monitor{monitor__}
+		{
+			// the same for every run, prepare() only touches the validators
+			__request.method(boost::beast::http::verb::get);
+			__request.version(11);
+			__request.target(__uri);
+			__request.set(boost::beast::http::field::host, __authority);
+			__request.set(boost::beast::http::field::content_type, "text/html");
+			__request.set(boost::beast::http::field::accept_encoding, "gzip, deflate, br");
+			__monitor.attach(0, * this);
+		}
+	public:
+		boost::asio::awaitable<void> run(uget::body_sink & sink__)
+		{
+			auto bytes = co_await this->run_it(sink__);
+			if (bytes == 0)
+				std::clog << "got nothing" << std::endl;
+			else
+				std::clog << "got: " << bytes << " bytes" << std::endl;
+			co_await this->finish();
+		}
+	public:
+		boost::asio::awaitable<std::string> run_it()
+		{
+			uget::string_sink sink;
+			co_await this->run_it(sink);
+			co_return std::move(sink.body());
+		}
+		// returns the number of body bytes written into sink__
+		boost::asio::awaitable<std::size_t> run_it(uget::body_sink & sink__)
+		{
+			// a client runs again once it is finish()ed
+			__complete = false;
+			__cache_hit = false;
+			__cached.reset();
+			__body_bytes = 0;
+
+			auto begin = std::chrono::steady_clock::now();
+			std::size_t bytes = 0;
+			try
+			{
+				if (this->cached_fresh())
+					bytes = co_await uget::http_cache::serve(* __cached, sink__);
+				else
+					bytes = co_await this->attempts(sink__);
+			}
+			catch (...)
+			{
+				__monitor.record_failure();
+				throw;
+			}
+			__monitor.record(uget::net_monitor::phase::request, std::chrono::steady_clock::now() - begin);
+			__monitor.record_bytes(bytes);
+			co_return bytes;
+		}
+	private:
+		// Every failed attempt throws the connection away, so a retry after a
+		// broken stream always starts from connect + handshake.
+		boost::asio::awaitable<std::size_t> attempts(uget::body_sink & sink__)
+		{
+			__deadline = std::chrono::steady_clock::now() + __policy.deadline;
+			for (int attempt = 1; ; ++attempt)
+			{
+				std::error_code error;
+				bool reused = false;
+				bool stale = false;
+				try
+				{
+					__parser.reset();
+					__connection = __pool.acquire<Transport>(__host, __port);
+					reused = static_cast<bool>(__connection);
+					__reused = reused;
+					if (! reused)
+					{
+						__connection = std::make_shared<connection_type>(__transport, __executor);
+						auto endpoints = co_await this->resolve();
+						this->check_cancelled();
+						co_await this->connect(endpoints);
+						this->check_cancelled();
+						co_await this->handshake();
+						// a cancel() that found an offloaded handshake finished
+						this->check_cancelled();
+					}
+					co_return co_await this->exchange(sink__);
+				}
+				catch (const std::system_error & e)
+				{
+					// part of the body is already in the sink, it can not be replayed
+					if (__body_bytes != 0 || __cancelled)
+						throw;
+					stale = reused && this->stale(e.code());
+					if (! stale && (attempt >= __policy.max_attempts || ! __policy.retryable(e.code())))
+						throw;
+					error = e.code();
+					std::clog << "attempt " << attempt << " failed: " << e.what() << std::endl;
+				}
+
+				if (__connection)
+					__connection->close();
+				__connection.reset();
+				if (stale)
+				{
+					// the server dropped it between our liveness check and the request,
+					// that is not the server being unhealthy: go again at once
+					--attempt;
+					continue;
+				}
+
+				auto delay = __policy.deadline == std::chrono::steady_clock::duration::zero()
+					? __policy.delay(attempt)
+					: std::min(__policy.delay(attempt), this->remaining());
+				if (delay <= std::chrono::steady_clock::duration::zero())
+					throw std::system_error{error, "deadline exceeded after "s + std::to_string(attempt) + " attempts"};
+				std::clog << "retrying in " << std::chrono::duration_cast<std::chrono::milliseconds>(delay).count()
+					<< "ms ..." << std::endl;
+				__backoff.expires_after(delay);
+				co_await __backoff.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+				this->check_cancelled();
+			}
+		}
+		// a pooled connection that failed before any of the response came
+		// back, the way one the server closed in the meantime does
+		bool stale(const std::error_code & ec__) const
+		{
+			if (! __connection || __connection->buffer().size() != 0)
+				return false;
+			if (__parser && __parser->got_some())
+				return false;
+			return uget::retry_policy::closed(ec__);
+		}
+		void check_cancelled() const
+		{
+			if (__cancelled)
+				throw std::system_error{std::make_error_code(std::errc::operation_canceled), "request cancelled"};
+		}
+	public:
+		// Stops the request from another coroutine on the same executor:
+		// whatever it is waiting on (resolve, connect, the backoff, the
+		// connection) fails and it is not retried. The connection is not pooled.
+		void cancel()
+		{
+			__cancelled = true;
+			__resolver.cancel();
+			__backoff.cancel();
+			if (__race)
+				__race->cancel();
+			if (__offloaded)
+			{
+				// the socket belongs to the crypto strand until the handshake is back
+				boost::asio::post(
+					__offloaded->strand,
+					[job = __offloaded, connection = __connection]
+					{
+						if (! job->finished)
+							connection->close();
+					}
+				);
+			}
+			else if (__connection)
+			{
+				__connection->close();
+			}
+		}
+		void policy(const uget::retry_policy & policy__)
+		{
+			__policy = policy__;
+		}
+		// ask for gzip/deflate/br and decode it on the way into the sink;
+		// range requests must turn this off, ranges are of the encoded form
+		void decode(bool decode__)
+		{
+			__decode = decode__;
+			if (__decode)
+				__request.set(boost::beast::http::field::accept_encoding, "gzip, deflate, br");
+			else
+				__request.erase(boost::beast::http::field::accept_encoding);
+		}
+		// use the http cache, when it is open; the load test turns this off
+		void cache(bool cacheable__)
+		{
+			__cacheable = cacheable__;
+		}
+	private:
+		bool cache_applies() const
+		{
+			return __cacheable
+				&& uget::http_cache::shared().enabled()
+				&& __request.method() == boost::beast::http::verb::get
+				&& __request.count(boost::beast::http::field::range) == 0;
+		}
+		// "<method> <url> <range or ->", how --record files a response
+		std::string archive_head() const
+		{
+			return std::string{__request.method_string()} + ' '
+				+ std::string{Transport::scheme} + "://"
+				+ (__host.find(':') == std::string::npos ? __host : '[' + __host + ']') + ':' + __port + __uri + ' '
+				+ uget::archive::range(__request[boost::beast::http::field::range]);
+		}
+		// the stored body is decoded or not, so that is part of the key
+		std::string cache_key() const
+		{
+			return std::string{Transport::scheme} + "://" + __host + ':' + __port + __uri
+				+ (__decode ? "" : " identity");
+		}
+		// loads the entry for revalidation, true when it can be served as is
+		bool cached_fresh()
+		{
+			if (! this->cache_applies())
+				return false;
+			__cached = uget::http_cache::shared().find(this->cache_key());
+			__cache_hit = __cached && __cached->fresh();
+			if (__cache_hit)
+				this->signal("served from cache: " + __cached->url);
+			return __cache_hit;
+		}
+	private:
+		std::chrono::steady_clock::duration remaining() const
+		{
+			return __deadline - std::chrono::steady_clock::now();
+		}
+		// a phase before the body never gets more time than is left of the deadline
+		std::chrono::steady_clock::duration timeout(std::chrono::steady_clock::duration phase__) const
+		{
+			if (__policy.deadline == std::chrono::steady_clock::duration::zero())
+				return phase__;
+			auto left = this->remaining();
+			if (left <= std::chrono::steady_clock::duration::zero())
+				throw std::system_error{
+					boost::system::error_code{boost::beast::error::timeout},
+					"deadline exceeded"
+				};
+			return std::min(phase__, left);
+		}
+	public:
+		boost::asio::awaitable<std::size_t> exchange(uget::body_sink & sink__)
+		{
+			this->prepare();
+			co_await this->write();
+			co_return co_await this->read(sink__);
+		}
+		// the validators of the entry being revalidated, none without one
+		void prepare()
+		{
+			__request.erase(boost::beast::http::field::if_none_match);
+			__request.erase(boost::beast::http::field::if_modified_since);
+			if (! __cached)
+				return;
+			auto etag = __cached->header.find(boost::beast::http::field::etag);
+			if (etag != __cached->header.end())
+				__request.set(boost::beast::http::field::if_none_match, etag->value());
+			auto modified = __cached->header.find(boost::beast::http::field::last_modified);
+			if (modified != __cached->header.end())
+				__request.set(boost::beast::http::field::if_modified_since, modified->value());
+		}
+		// the Host value: a v6 address goes in brackets, a port other than
+		// the scheme's is named
+		static std::string authority(const std::string & host__, const std::string & port__)
+		{
+			auto result = host__.find(':') == std::string::npos ? host__ : '[' + host__ + ']';
+			if (port__ != Transport::default_port)
+				result += ':' + port__;
+			return result;
+		}
+	public:
+		// A connection for someone else to drive (pipelining): pooled if
+		// possible, else connected and handshaked. Starts this client's deadline.
+		boost::asio::awaitable<connection_ptr> open()
+		{
+			__deadline = std::chrono::steady_clock::now() + __policy.deadline;
+			__connection = __pool.acquire<Transport>(__host, __port);
+			__reused = static_cast<bool>(__connection);
+			if (! __reused)
+			{
+				__connection = std::make_shared<connection_type>(__transport, __executor);
+				co_await this->connect(co_await this->resolve());
+				co_await this->handshake();
+			}
+			co_return __connection;
+		}
+		// run write() and read() on a connection opened elsewhere
+		void use(connection_ptr connection__)
+		{
+			__connection = std::move(connection__);
+			__deadline = std::chrono::steady_clock::now() + __policy.deadline;
+			this->prepare();
+		}
+	public:
+		boost::asio::awaitable<std::vector<boost::asio::ip::tcp::endpoint>> resolve()
+		{
+			auto begin = std::chrono::steady_clock::now();
+			auto endpoints = co_await uget::dns_cache::shared().resolve(__resolver, __host, __port);
+			__monitor.record(uget::net_monitor::phase::resolve, std::chrono::steady_clock::now() - begin);
+			co_return endpoints;
+		}
+	public:
+		boost::asio::awaitable<void> connect(const std::vector<boost::asio::ip::tcp::endpoint> & endpoints__)
+		{
+			// a member, so that cancel() reaches the attempts
+			__race = std::make_shared<uget::connect_race>(
+				__executor,
+				endpoints__,
+				std::chrono::milliseconds(250),
+				this->timeout(__policy.connect_timeout)
+			);
+			auto begin = std::chrono::steady_clock::now();
+			try
+			{
+				auto race = __race;
+				__connection->lowest().socket() = co_await race->run();
+				__race.reset();
+			}
+			catch (const std::system_error &)
+			{
+				__race.reset();
+				if (! __cancelled)
+					uget::dns_cache::shared().forget(__host, __port);
+				throw;
+			}
+			__monitor.record(uget::net_monitor::phase::connect, std::chrono::steady_clock::now() - begin);
+			if (uget::trace::shared().enabled())
+				std::clog << "connected" << std::endl;
+		}
+	public:
+		boost::asio::awaitable<void> handshake()
+		{
+			if constexpr (! Transport::secure)
+				co_return;
+			auto begin = std::chrono::steady_clock::now();
+			boost::system::error_code ec;
+			if (uget::crypto_pool::shared().enabled())
+			{
+				ec = co_await this->offloaded_handshake();
+			}
+			else
+			{
+				__connection->lowest().expires_after(this->timeout(__policy.handshake_timeout));
+				ec = co_await Transport::handshake(__connection->stream(), co_await boost::asio::this_coro::executor);
+			}
+			if (ec)
+				throw std::system_error{ec, "handshake error"};
+			__monitor.record(uget::net_monitor::phase::handshake, std::chrono::steady_clock::now() - begin);
+			this->signal("async handshaked");
+		}
+	private:
+		// The coroutine moves onto a crypto pool strand for the handshake and
+		// back after it, so nothing on the io_context touches the stream in
+		// between. The tcp_stream timeout would fire on the io_context, so
+		// the deadline is a timer on the strand, and cancel() posts there.
+		// Whatever happens on the strand, it goes home before it returns or
+		// throws: retries and the pool belong to the io_context thread.
+		boost::asio::awaitable<boost::system::error_code> offloaded_handshake()
+		{
+			auto home = co_await boost::asio::this_coro::executor;
+			// a deadline used up by connect throws here, still at home
+			auto timeout = this->timeout(__policy.handshake_timeout);
+			auto job = uget::crypto_pool::shared().submit();
+			__offloaded = job;
+			__connection->lowest().expires_never();
+
+			co_await boost::asio::post(boost::asio::bind_executor(job->strand, boost::asio::use_awaitable));
+			boost::system::error_code ec;
+			std::exception_ptr error;
+			try
+			{
+				boost::asio::steady_timer deadline{job->strand, timeout};
+				deadline.async_wait(
+					[job, connection = __connection] (const boost::system::error_code & ec__)
+					{
+						if (ec__ || job->finished)
+							return;
+						job->expired = true;
+						connection->close();
+					}
+				);
+				ec = co_await Transport::handshake(__connection->stream(), job->strand);
+				job->finished = true;
+				deadline.cancel();
+			}
+			catch (...)
+			{
+				job->finished = true;
+				error = std::current_exception();
+			}
+			co_await boost::asio::post(boost::asio::bind_executor(home, boost::asio::use_awaitable));
+
+			__offloaded.reset();
+			if (error)
+				std::rethrow_exception(error);
+			if (job->expired)
+				co_return boost::beast::error::timeout;
+			co_return ec;
+		}
+	private:
+		// the completion token of a request's reads and writes: asio and
+		// beast allocate the operations through the handler's associated
+		// allocator, so they come from the thread's block_pool
+		static auto pooled()
+		{
+			return boost::asio::as_tuple(
+				boost::asio::bind_allocator(uget::recycling_allocator<char>{}, boost::asio::use_awaitable)
+			);
+		}
+	public:
+		boost::asio::awaitable<void> write()
+		{
+			if (uget::rate_limits::shared().enabled())
+			{
+				// waiting for the request budget is not the server being slow
+				auto waiting = std::chrono::steady_clock::now();
+				co_await uget::rate_limits::shared().request(__host);
+				__deadline += std::chrono::steady_clock::now() - waiting;
+			}
+			__sent = std::chrono::steady_clock::now();
+			__connection->lowest().expires_after(this->timeout(__policy.write_timeout));
+			auto [ec, bytes] = co_await boost::beast::http::async_write(
+				__connection->stream(),
+				__request,
+				pooled()
+			);
+			if (ec)
+				throw std::system_error{ec, "async write error"};
+			if (uget::trace::shared().enabled())
+				std::clog << "Request ok\n";
+		}
+	public:
+		boost::asio::awaitable<std::size_t> read(uget::body_sink & sink__)
+		{
+			__parser.emplace();
+			__parser->body_limit(boost::none);
+			if (__request.method() == boost::beast::http::verb::head)
+				__parser->skip(true);
+			__body_bytes = 0;
+
+			__connection->lowest().expires_after(this->timeout(__policy.read_timeout));
+			auto [ec, bytes] = co_await boost::beast::http::async_read_header(
+				__connection->stream(),
+				__connection->buffer(),
+				* __parser,
+				pooled()
+			);
+			if (ec)
+				throw std::system_error{ec, "async read header error"};
+			auto first_byte = std::chrono::steady_clock::now();
+			__monitor.record(uget::net_monitor::phase::first_byte, first_byte - __sent);
+			if (uget::trace::shared().enabled())
+				std::clog << "Async read header ok\n";
+
+			if (__cached && __parser->get().result() == boost::beast::http::status::not_modified)
+			{
+				// still good: the body comes from the cache, the connection carries on
+				uget::http_cache::shared().refresh(* __cached, __parser->get().base());
+				this->signal("not modified, served from cache: " + __cached->url);
+				__body_bytes = co_await uget::http_cache::serve(* __cached, sink__);
+				__monitor.record(uget::net_monitor::phase::transfer, std::chrono::steady_clock::now() - first_byte);
+				__complete = true;
+				co_return __body_bytes;
+			}
+
+			// the cache keeps what the sink gets, so it sits after the decoder
+			std::unique_ptr<uget::body_sink> store;
+			if (this->cache_applies())
+				store = uget::http_cache::shared().store(this->cache_key(), __parser->get().base(), sink__);
+			uget::body_sink & stored = store ? * store : sink__;
+
+			std::unique_ptr<uget::body_sink> decoder;
+			if (__decode)
+				decoder = uget::make_decoder(__parser->get()[boost::beast::http::field::content_encoding], stored);
+			uget::body_sink & decoded = decoder ? * decoder : stored;
+
+			// the archive keeps the body as it came, so it sits before the decoder
+			std::unique_ptr<uget::body_sink> recorder;
+			if (uget::archive::shared().recording())
+			{
+				std::ostringstream header;
+				header << __parser->get().base();
+				recorder = uget::archive::shared().record(
+					this->archive_head(),
+					header.str(),
+					first_byte - __sent,
+					decoded
+				);
+			}
+			uget::body_sink & sink = recorder ? * recorder : decoded;
+			// decoded bodies have no known length
+			if (! decoder && __request.method() != boost::beast::http::verb::head && __parser->content_length())
+				sink__.expect(* __parser->content_length());
+
+			if (! __chunk)
+				__chunk = uget::pooled_buffer{chunk_size};
+
+			// the timeout is per chunk and the deadline is over, a large body
+			// is fine as long as it keeps moving
+			while (! __parser->is_done())
+			{
+				auto & body = __parser->get().body();
+				body.data = __chunk.get();
+				body.size = chunk_size;
+
+				__connection->lowest().expires_after(__policy.read_timeout);
+				auto [ec, bytes] = co_await boost::beast::http::async_read(
+					__connection->stream(),
+					__connection->buffer(),
+					* __parser,
+					pooled()
+				);
+				if (ec == boost::beast::http::error::need_buffer)
+					ec = {};
+				if (ec)
+					throw std::system_error{ec, "async read body error"};
+
+				std::size_t got = chunk_size - body.size;
+				if (got != 0)
+				{
+					co_await sink.write(boost::asio::const_buffer{__chunk.get(), got});
+					__body_bytes += got;
+					// wire bytes, before decoding; the next read waits for the budget
+					if (uget::rate_limits::shared().enabled())
+						co_await uget::rate_limits::shared().bytes(__host, got);
+				}
+			}
+			co_await sink.close();
+			__monitor.record(uget::net_monitor::phase::transfer, std::chrono::steady_clock::now() - first_byte);
+
+			this->signal("Read OK: http body is got successfully.");
+			__complete = true;
+			co_return __body_bytes;
+		}
+	public:
+		// hand a reusable connection back to the pool, close anything else
+		boost::asio::awaitable<void> finish()
+		{
+			if (! __connection)
+				co_return;
+			if (this->keep_alive())
+			{
+				__pool.release(__host, __port, std::move(__connection));
+				this->signal("connection kept alive for reuse");
+				co_return;
+			}
+			co_await this->shutdown();
+		}
+	public:
+		boost::asio::awaitable<void> shutdown()
+		{
+			__connection->lowest().expires_after(std::chrono::seconds(2));
+			auto ec = co_await Transport::shutdown(__connection->stream());
+			if (uget::trace::shared().enabled())
+				std::clog << "closed: " << ec << std::endl;
+			this->signal("async shutdown OK. "s + ec.message());
+		}
+	public:
+		unsigned status() const
+		{
+			if (__cache_hit)
+				return 200;
+			return __parser ? __parser->get().result_int() : 0;
+		}
+		bool keep_alive() const
+		{
+			return __complete && __parser->keep_alive();
+		}
+		std::size_t body_bytes() const
+		{
+			return __body_bytes;
+		}
+		// whether the last attempt went out on a pooled connection
+		bool reused() const
+		{
+			return __reused;
+		}
+		// extra request fields (Range, ...) and the method are set here before run_it()
+		request_type & request()
+		{
+			return __request;
+		}
+		// the response header, valid once the body has started
+		const boost::beast::http::response_header<fields_type> & header() const
+		{
+			return __parser->get().base();
+		}
+		// of the body the sink got, also when it came from the http cache
+		std::string_view content_type() const
+		{
+			bool cached = __cache_hit
+				|| (__cached && __parser && __parser->get().result() == boost::beast::http::status::not_modified);
+			if (cached)
+				return __cached->header[boost::beast::http::field::content_type];
+			return __parser ? __parser->get()[boost::beast::http::field::content_type] : std::string_view{};
+		}
+	public:
+		uget::net_monitor::connection_type connect(
+			int prior__,
+			const uget::net_monitor::slot_type & slot__
+		)
+		{
+			return __signal.connect(prior__, slot__);
+		}
+		void signal(std::string_view msg__)
+		{
+			if (! __signal.empty())
+				this->__signal(std::string{msg__});
+		}
+		// no net_monitor messages from this client (load tests)
+		void quiet()
+		{
+			__signal.disconnect_all_slots();
+		}
+	};
+
+	using tls_client = uget::basic_client<uget::tls_transport>;
+	using http_client = uget::basic_client<uget::tcp_transport>;
+
+	template<class Transport>
+	void uget::net_monitor::attach(
+		int prior__,
+		uget::basic_client<Transport> & client__
+	)
+	{
+		client__.connect(
+			prior__,
+			std::bind(
+				&uget::net_monitor::queue_message,
+				this,
+				_1
+			)
+		);
+	}
+
+	// https://host[:port]/target or http://host[:port]/target;
+	// secure picks tls_client or http_client
+	class url
+	{
+	public:
+		std::string host;
+		std::string port;
+		std::string target;
+		bool secure = true;
+	public:
+		static std::optional<uget::url> parse(std::string_view text__)
+		{
+			uget::url result;
+			auto scheme = text__.find("://");
+			if (scheme == std::string_view::npos)
+				return std::nullopt;
+			if (text__.substr(0, scheme) == uget::tcp_transport::scheme)
+				result.secure = false;
+			else if (text__.substr(0, scheme) != uget::tls_transport::scheme)
+				return std::nullopt;
+			text__.remove_prefix(scheme + 3);
+
+			text__ = text__.substr(0, text__.find('#'));
+			auto end = text__.find_first_of("/?");
+			std::string_view authority = text__.substr(0, end);
+			if (end == std::string_view::npos)
+				result.target = "/";
+			else if (text__[end] == '?')
+				result.target = '/' + std::string{text__.substr(end)};
+			else
+				result.target = text__.substr(end);
+
+			// [v6 address][:port] keeps the address without brackets, for the resolver
+			std::string_view port;
+			if (authority.starts_with('['))
+			{
+				auto close = authority.find(']');
+				if (close == std::string_view::npos)
+					return std::nullopt;
+				result.host = authority.substr(1, close - 1);
+				auto rest = authority.substr(close + 1);
+				if (! rest.empty() && rest.front() != ':')
+					return std::nullopt;
+				port = rest.empty() ? result.default_port() : rest.substr(1);
+			}
+			else
+			{
+				auto colon = authority.find(':');
+				result.host = authority.substr(0, colon);
+				port = colon == std::string_view::npos ? result.default_port() : authority.substr(colon + 1);
+			}
+			result.port = port;
+			if (result.host.empty() || result.port.empty())
+				return std::nullopt;
+			return result;
+		}
+	public:
+		std::string_view scheme() const
+		{
+			return secure ? uget::tls_transport::scheme : uget::tcp_transport::scheme;
+		}
+		std::string_view default_port() const
+		{
+			return secure ? uget::tls_transport::default_port : uget::tcp_transport::default_port;
+		}
+		std::string str() const
+		{
+			return std::string{this->scheme()} + "://" + uget::url::authority_host(host)
+				+ (port == this->default_port() ? ""s : ':' + port) + target;
+		}
+		// the host as written in a url or a Host header: v6 addresses in brackets
+		static std::string authority_host(std::string_view host__)
+		{
+			if (host__.find(':') == std::string_view::npos)
+				return std::string{host__};
+			return '[' + std::string{host__} + ']';
+		}
+		// A link found on this page as an absolute url; nullopt for other
+		// schemes (mailto:, javascript:, ...) and for links to this page itself.
+		// The fragment is dropped, dot segments are removed.
+		std::optional<uget::url> resolve(std::string_view link__) const
+		{
+			link__ = link__.substr(0, link__.find('#'));
+			while (! link__.empty() && std::isspace(static_cast<unsigned char>(link__.front())))
+				link__.remove_prefix(1);
+			while (! link__.empty() && std::isspace(static_cast<unsigned char>(link__.back())))
+				link__.remove_suffix(1);
+			if (link__.empty())
+				return std::nullopt;
+
+			if (link__.starts_with("//"))
+				return uget::url::parse(std::string{this->scheme()} + ':' + std::string{link__});
+			auto colon = link__.find(':');
+			if (colon != std::string_view::npos && link__.find_first_of("/?") > colon)
+			{
+				auto scheme = link__.substr(0, colon);
+				bool is_scheme = std::isalpha(static_cast<unsigned char>(scheme.front()));
+				for (auto c: scheme)
+					is_scheme = is_scheme && (std::isalnum(static_cast<unsigned char>(c)) || c == '+' || c == '-' || c == '.');
+				if (is_scheme)
+					return uget::url::parse(link__);
+			}
+
+			uget::url result = * this;
+			auto path = std::string_view{target}.substr(0, target.find('?'));
+			if (link__.front() == '/')
+				result.target = normalize(link__);
+			else if (link__.front() == '?')
+				result.target = std::string{path} + std::string{link__};
+			else
+				result.target = normalize(std::string{path.substr(0, path.rfind('/') + 1)} + std::string{link__});
+			return result;
+		}
+	private:
+		// "/a/./b/../c?q" -> "/a/c?q"
+		static std::string normalize(std::string_view target__)
+		{
+			auto query = target__.find('?');
+			auto path = target__.substr(0, query);
+			std::vector<std::string_view> segments;
+			bool directory = false;
+			while (! path.empty())
+			{
+				auto slash = path.find('/', 1);
+				auto segment = path.substr(1, slash == std::string_view::npos ? std::string_view::npos : slash - 1);
+				path = slash == std::string_view::npos ? "" : path.substr(slash);
+				directory = segment == "." || segment == ".." || segment.empty();
+				if (segment == "..")
+				{
+					if (! segments.empty())
+						segments.pop_back();
+				}
+				else if (segment != ".")
+				{
+					if (! segment.empty() || path.empty())
+						segments.push_back(segment);
+				}
+			}
+			std::string result;
+			for (auto segment: segments)
+			{
+				if (! segment.empty())
+					result += '/' + std::string{segment};
+			}
+			if (result.empty() || directory)
+				result += '/';
+			if (query != std::string_view::npos)
+				result += target__.substr(query);
+			return result;
+		}
+	public:
+		// Flat file name for saving the body into an output directory.
+		// Everything but letters, digits, '.', '-' and '_' is percent-escaped,
+		// '%' included, so two urls never share a file: "/a/b" is "a%2Fb",
+		// "/a_b" stays "a_b".
+		std::string file_name() const
+		{
+			constexpr std::string_view hex = "0123456789ABCDEF";
+			std::string name;
+			for (unsigned char c: port == this->default_port() ? host + target : host + ':' + port + target)
+			{
+				if (std::isalnum(c) || c == '.' || c == '-' || c == '_')
+				{
+					name += static_cast<char>(c);
+				}
+				else
+				{
+					name += '%';
+					name += hex[c >> 4];
+					name += hex[c & 0xf];
+				}
+			}
+			return name;
+		}
+	};
+
+	// Pulls link targets out of HTML as it streams by, without building a
+	// tree: a small state machine over tags and attributes that carries on
+	// across chunk boundaries. Reports href of a, area, link and base and
+	// src of frame, iframe, img, script and source; skips comments and the
+	// text of script and style. Names and values are capped, so no page
+	// makes it hold more than a few KiB.
+	class link_extractor
+	{
+	public:
+		// tag, link as written in the page
+		using callback_type = std::function<void(std::string_view, std::string_view)>;
+	private:
+		enum class state
+		{
+			text,
+			open,
+			bang,
+			tag,
+			attributes,
+			name,
+			after_name,
+			before_value,
+			quoted,
+			unquoted,
+			comment,
+			bogus,
+			raw
+		};
+		static constexpr std::size_t max_name = 16;
+		static constexpr std::size_t max_value = 4096;
+	private:
+		state __state;
+		bool __closing;
+		char __quote;
+		std::size_t __match;
+		std::string __tag;
+		std::string __name;
+		std::string __value;
+		std::string __raw_end;
+		callback_type __callback;
+	public:
+		explicit link_extractor(callback_type callback__):
+			__state{state::text},
+			__closing{false},
+			__quote{0},
+			__match{0},
+			__tag{},
+			__name{},
+			__value{},
+			__raw_end{},
+			__callback{std::move(callback__)}
+		{
+		}
+	public:
+		void feed(std::string_view data__)
+		{
+			for (char c: data__)
+				this->step(c);
+		}
+	private:
+		void step(char c__)
+		{
+			auto lower = static_cast<char>(std::tolower(static_cast<unsigned char>(c__)));
+			bool space = std::isspace(static_cast<unsigned char>(c__));
+			switch (__state)
+			{
+			case state::text:
+				if (c__ == '<')
+					__state = state::open;
+				break;
+			case state::open:
+				__tag.clear();
+				__closing = c__ == '/';
+				if (c__ == '!')
+				{
+					__match = 0;
+					__state = state::bang;
+				}
+				else if (c__ == '/')
+					__state = state::tag;
+				else if (std::isalpha(static_cast<unsigned char>(c__)))
+				{
+					__tag = lower;
+					__state = state::tag;
+				}
+				else if (c__ == '?')
+					__state = state::bogus;
+				else if (c__ != '<')
+					__state = state::text;
+				break;
+			case state::bang:
+				// "<!--" opens a comment, anything else (<!doctype) runs to '>'
+				if (c__ == '-' && ++__match == 2)
+				{
+					__match = 0;
+					__state = state::comment;
+				}
+				else if (c__ != '-')
+					__state = c__ == '>' ? state::text : state::bogus;
+				break;
+			case state::tag:
+				if (c__ == '>')
+					this->end_tag();
+				else if (space || c__ == '/')
+					__state = state::attributes;
+				else if (__tag.size() < max_name)
+					__tag += lower;
+				break;
+			case state::attributes:
+				if (c__ == '>')
+					this->end_tag();
+				else if (! space && c__ != '/')
+				{
+					__name = lower;
+					__state = state::name;
+				}
+				break;
+			case state::name:
+				if (c__ == '=')
+					__state = state::before_value;
+				else if (space)
+					__state = state::after_name;
+				else if (c__ == '>')
+					this->end_tag();
+				else if (c__ == '/')
+					__state = state::attributes;
+				else if (__name.size() < max_name)
+					__name += lower;
+				break;
+			case state::after_name:
+				if (c__ == '=')
+					__state = state::before_value;
+				else if (c__ == '>')
+					this->end_tag();
+				else if (! space)
+				{
+					__name = lower;
+					__state = state::name;
+				}
+				break;
+			case state::before_value:
+				__value.clear();
+				if (c__ == '"' || c__ == '\'')
+				{
+					__quote = c__;
+					__state = state::quoted;
+				}
+				else if (c__ == '>')
+					this->end_tag();
+				else if (! space)
+				{
+					__value += c__;
+					__state = state::unquoted;
+				}
+				break;
+			case state::quoted:
+				if (c__ == __quote)
+				{
+					this->attribute();
+					__state = state::attributes;
+				}
+				else if (__value.size() < max_value)
+					__value += c__;
+				break;
+			case state::unquoted:
+				if (space || c__ == '>')
+				{
+					this->attribute();
+					if (c__ == '>')
+						this->end_tag();
+					else
+						__state = state::attributes;
+				}
+				else if (__value.size() < max_value)
+					__value += c__;
+				break;
+			case state::comment:
+				if (c__ == '>' && __match >= 2)
+					__state = state::text;
+				else if (c__ == '-')
+					++__match;
+				else
+					__match = 0;
+				break;
+			case state::bogus:
+				if (c__ == '>')
+					__state = state::text;
+				break;
+			case state::raw:
+				// until "</script" or "</style", then that end tag is read as usual
+				if (lower == __raw_end[__match])
+				{
+					if (++__match == __raw_end.size())
+					{
+						__tag = __raw_end.substr(2);
+						__closing = true;
+						__state = state::tag;
+					}
+				}
+				else
+					__match = lower == __raw_end[0] ? 1 : 0;
+				break;
+			}
+		}
+		void end_tag()
+		{
+			__state = state::text;
+			if (! __closing && (__tag == "script" || __tag == "style"))
+			{
+				__raw_end = "</" + __tag;
+				__match = 0;
+				__state = state::raw;
+			}
+		}
+		void attribute()
+		{
+			if (__closing || ! wanted(__tag, __name))
+				return;
+			// &amp; is the only entity that shows up in urls in practice
+			for (auto at = __value.find("&amp;"); at != std::string::npos; at = __value.find("&amp;", at + 1))
+				__value.erase(at + 1, 4);
+			__callback(__tag, __value);
+		}
+		static bool wanted(std::string_view tag__, std::string_view name__)
+		{
+			if (name__ == "href")
+				return tag__ == "a" || tag__ == "area" || tag__ == "link" || tag__ == "base";
+			if (name__ == "src")
+				return tag__ == "frame" || tag__ == "iframe" || tag__ == "img"
+					|| tag__ == "script" || tag__ == "source";
+			return false;
+		}
+	};
+
+	// Passes the body on and, when html__() says the response is HTML
+	// (asked once, at the first chunk), runs it through a link_extractor.
+	class link_sink: virtual public uget::body_sink
+	{
+	private:
+		uget::body_sink & __next;
+		uget::link_extractor __links;
+		std::function<bool()> __html;
+		std::optional<bool> __enabled;
+	public:
+		link_sink(
+			uget::body_sink & next__,
+			std::function<bool()> html__,
+			uget::link_extractor::callback_type callback__
+		):
+			__next{next__},
+			__links{std::move(callback__)},
+			__html{std::move(html__)},
+			__enabled{}
+		{
+		}
+	public:
+		boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+		{
+			if (! __enabled)
+				__enabled = __html();
+			if (* __enabled)
+				__links.feed({static_cast<const char *>(data__.data()), data__.size()});
+			co_await __next.write(data__);
+		}
+		boost::asio::awaitable<void> close() override
+		{
+			co_await __next.close();
+		}
+		void expect(std::uint64_t length__) override
+		{
+			__next.expect(length__);
+		}
+	};
+
+	// Urls the crawler has seen, in bounded memory. A Bloom filter says
+	// "new" for nearly every new url without looking any further; the exact
+	// answer comes from 128 bit url hashes, the recent ones in a std::set and
+	// the rest in a sorted file that the recent ones are merged into every
+	// spill_size insertions, searched through a read-only mapping.
+	class seen_set
+	{
+	private:
+		using key_type = std::array<std::uint64_t, 2>;
+		static constexpr std::size_t spill_size = 64 * 1024;
+		static constexpr int hash_count = 7;
+	private:
+		std::vector<std::uint64_t> __bloom;
+		std::set<key_type> __recent;
+		const std::filesystem::path __path;
+		std::unique_ptr<uget::mapped_file> __stored;
+		std::unique_ptr<Botan::HashFunction> __hash;
+		std::uint64_t __size;
+	public:
+		// about 10 bits per expected url: 1% false positives
+		seen_set(std::uint64_t expected__, const std::filesystem::path & path__):
+			__bloom((std::max<std::uint64_t>(expected__, 1024) * 10 + 63) / 64),
+			__recent{},
+			__path{path__},
+			__stored{},
+			__hash{Botan::HashFunction::create_or_throw("SHA-256")},
+			__size{0}
+		{
+			std::filesystem::create_directories(__path.parent_path());
+			std::ofstream{__path, std::ios::binary | std::ios::trunc};
+			__stored = std::make_unique<uget::mapped_file>(__path);
+		}
+		seen_set(const seen_set &) = delete;
+		seen_set & operator=(const seen_set &) = delete;
+		~seen_set()
+		{
+			__stored.reset();
+			std::error_code ec;
+			std::filesystem::remove(__path, ec);
+		}
+	public:
+		// true when url__ was not in the set
+		bool insert(std::string_view url__)
+		{
+			auto key = this->key(url__);
+			auto bits = __bloom.size() * 64;
+			bool maybe = true;
+			for (int i = 0; i < hash_count; ++i)
+			{
+				auto bit = (key[0] + i * key[1]) % bits;
+				maybe = maybe && (__bloom[bit / 64] >> (bit % 64) & 1);
+			}
+			if (maybe && (__recent.contains(key) || this->stored(key)))
+				return false;
+
+			for (int i = 0; i < hash_count; ++i)
+			{
+				auto bit = (key[0] + i * key[1]) % bits;
+				__bloom[bit / 64] |= std::uint64_t{1} << (bit % 64);
+			}
+			__recent.insert(key);
+			++__size;
+			if (__recent.size() >= spill_size)
+				this->spill();
+			return true;
+		}
+		std::uint64_t size() const
+		{
+			return __size;
+		}
+	private:
+		key_type key(std::string_view url__)
+		{
+			__hash->update(reinterpret_cast<const std::uint8_t *>(url__.data()), url__.size());
+			auto digest = __hash->final();
+			key_type key;
+			std::memcpy(key.data(), digest.data(), sizeof key);
+			return key;
+		}
+		std::span<const key_type> records() const
+		{
+			return {reinterpret_cast<const key_type *>(__stored->data()), __stored->size() / sizeof(key_type)};
+		}
+		bool stored(const key_type & key__) const
+		{
+			return std::ranges::binary_search(this->records(), key__);
+		}
+		// merge the recent keys into the sorted file
+		void spill()
+		{
+			auto tmp = __path;
+			tmp += ".tmp";
+			{
+				std::ofstream out{tmp, std::ios::binary | std::ios::trunc};
+				auto write = [&out] (const key_type & key__)
+				{
+					out.write(reinterpret_cast<const char *>(key__.data()), sizeof key__);
+				};
+				auto stored = this->records();
+				auto recent = __recent.begin();
+				for (const auto & key: stored)
+				{
+					for (; recent != __recent.end() && * recent < key; ++recent)
+						write(* recent);
+					write(key);
+				}
+				for (; recent != __recent.end(); ++recent)
+					write(* recent);
+				if (! out)
+					throw std::runtime_error{"can not write " + tmp.string()};
+			}
+			__stored.reset();
+			std::filesystem::rename(tmp, __path);
+			__stored = std::make_unique<uget::mapped_file>(__path);
+			__recent.clear();
+		}
+	};
+
+	// Pending urls of one host, shallowest first, then in the order they
+	// came in. Holds at most __limit: when full, a deeper url is refused,
+	// a shallower one takes the place of the deepest.
+	class frontier
+	{
+	public:
+		struct item
+		{
+			std::size_t depth;
+			std::uint64_t sequence;
+			uget::url url;
+		public:
+			bool operator<(const item & other__) const
+			{
+				return std::tie(depth, sequence) < std::tie(other__.depth, other__.sequence);
+			}
+		};
+	private:
+		std::set<item> __items;
+		std::size_t __limit;
+		std::uint64_t __sequence;
+	public:
+		explicit frontier(std::size_t limit__ = std::numeric_limits<std::size_t>::max()):
+			__items{},
+			__limit{std::max<std::size_t>(limit__, 1)},
+			__sequence{0}
+		{
+		}
+	public:
+		void push(uget::url url__, std::size_t depth__)
+		{
+			if (__items.size() >= __limit)
+			{
+				auto deepest = std::prev(__items.end());
+				if (deepest->depth <= depth__)
+					return;
+				__items.erase(deepest);
+			}
+			__items.insert({depth__, __sequence++, std::move(url__)});
+		}
+		item pop()
+		{
+			return std::move(__items.extract(__items.begin()).value());
+		}
+		bool empty() const
+		{
+			return __items.empty();
+		}
+		std::size_t size() const
+		{
+			return __items.size();
+		}
+	};
+
+	// Recent times to first byte per mirror (host:port), connect and
+	// handshake included, for ranking mirrors and timing hedges. A failed
+	// request counts as failure_penalty; one that lost a hedge counts as
+	// the time it had waited, which is less than it would have taken.
+	class mirror_stats
+	{
+	public:
+		using duration = std::chrono::steady_clock::duration;
+		static constexpr std::size_t window = 32;
+		static constexpr std::chrono::seconds failure_penalty{10};
+	private:
+		struct samples
+		{
+			std::array<duration, window> values{};
+			std::size_t count = 0;
+			std::size_t next = 0;
+		};
+	private:
+		mutable std::mutex __mutex;
+		std::map<std::string, samples, std::less<>> __mirrors;
+	public:
+		static uget::mirror_stats & shared()
+		{
+			static uget::mirror_stats result;
+			return result;
+		}
+	public:
+		void record(const uget::url & url__, duration value__)
+		{
+			std::lock_guard lock{__mutex};
+			auto & mirror = __mirrors[uget::connection_pool::key(url__.host, url__.port)];
+			mirror.values[mirror.next] = value__;
+			mirror.next = (mirror.next + 1) % window;
+			mirror.count = std::min(mirror.count + 1, window);
+		}
+		void fail(const uget::url & url__)
+		{
+			this->record(url__, failure_penalty);
+		}
+		// nothing until the mirror has been measured
+		std::optional<duration> percentile(const uget::url & url__, double p__) const
+		{
+			std::lock_guard lock{__mutex};
+			auto found = __mirrors.find(uget::connection_pool::key(url__.host, url__.port));
+			if (found == __mirrors.end() || found->second.count == 0)
+				return std::nullopt;
+			std::vector<duration> values(
+				found->second.values.begin(),
+				found->second.values.begin() + found->second.count
+			);
+			auto rank = std::min(values.size() - 1, static_cast<std::size_t>(std::ceil(p__ * values.size())) - 1);
+			std::ranges::nth_element(values, values.begin() + rank);
+			return values[rank];
+		}
+		// indices of urls__, fastest median first; mirrors not measured yet
+		// keep their given order after the measured ones
+		std::vector<std::size_t> rank(const std::vector<uget::url> & urls__) const
+		{
+			std::vector<std::pair<duration, std::size_t>> order;
+			for (std::size_t i = 0; i < urls__.size(); ++i)
+				order.emplace_back(this->percentile(urls__[i], 0.5).value_or(duration::max()), i);
+			std::ranges::stable_sort(order, {}, & std::pair<duration, std::size_t>::first);
+			std::vector<std::size_t> result;
+			for (const auto & [median, index]: order)
+				result.push_back(index);
+			return result;
+		}
+	};
+
+	// One object from several mirrors. The best ranked mirror is asked
+	// first; when nothing of its response has come by its p95 time to first
+	// byte, the next one is asked as well, and so on down the list. The
+	// first successful response to reach the sink wins and the others are
+	// cancelled before they write anything. A failed mirror, an error
+	// status included, hands over to the next one at once.
+	class hedged_fetch
+	{
+	private:
+		// the first time to first byte guess, before a mirror is measured
+		static constexpr std::chrono::milliseconds initial_delay{1000};
+	private:
+		struct attempt
+		{
+			std::chrono::steady_clock::time_point start;
+			std::function<void()> cancel;
+			std::exception_ptr error;
+			std::size_t bytes = 0;
+			unsigned status = 0;
+		};
+
+		// lets only the winner's body through; a response that is not a
+		// success fails its attempt here instead of taking the sink
+		class gate: virtual public uget::body_sink
+		{
+		private:
+			uget::hedged_fetch & __fetch;
+			const std::size_t __index;
+			const std::function<unsigned()> __status;
+		public:
+			gate(uget::hedged_fetch & fetch__, std::size_t index__, std::function<unsigned()> status__):
+				__fetch{fetch__},
+				__index{index__},
+				__status{std::move(status__)}
+			{
+			}
+		public:
+			boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+			{
+				this->claim();
+				co_await __fetch.__sink.write(data__);
+			}
+			boost::asio::awaitable<void> close() override
+			{
+				this->claim();
+				co_await __fetch.__sink.close();
+			}
+			void expect(std::uint64_t length__) override
+			{
+				this->claim();
+				__fetch.__sink.expect(length__);
+			}
+		private:
+			void claim()
+			{
+				// no Range is sent, so a 206 is as wrong as an error page;
+				// 304 comes with the cached body
+				auto status = __status();
+				if ((status < 200 || status >= 300 || status == 206) && status != 304)
+					throw std::runtime_error{
+						__fetch.__mirrors[__index].str() + " answered " + std::to_string(status)
+					};
+				__fetch.claim(__index);
+			}
+		};
+	private:
+		boost::asio::any_io_executor __executor;
+		const std::vector<uget::url> __mirrors;
+		uget::body_sink & __sink;
+		bool __decode;
+		std::vector<attempt> __attempts;
+		std::optional<std::size_t> __winner;
+		std::size_t __running;
+		std::size_t __failures;
+		boost::asio::steady_timer __event;
+	private:
+		uget::connection_pool & __pool;
+		uget::net_monitor & __monitor;
+	public:
+		hedged_fetch(
+			boost::asio::any_io_executor executor__,
+			std::vector<uget::url> mirrors__,
+			uget::body_sink & sink__,
+			uget::connection_pool & pool__,
+			uget::net_monitor & monitor__
+		):
+			__executor{executor__},
+			__mirrors{std::move(mirrors__)},
+			__sink{sink__},
+			__decode{true},
+			__attempts(__mirrors.size()),
+			__winner{},
+			__running{0},
+			__failures{0},
+			__event{executor__},
+
+			__pool{pool__},
+			__monitor{monitor__}
+		{
+		}
+	public:
+		void decode(bool decode__)
+		{
+			__decode = decode__;
+		}
+		// returns the number of body bytes the winner got
+		boost::asio::awaitable<std::size_t> run()
+		{
+			auto order = uget::mirror_stats::shared().rank(__mirrors);
+			std::size_t next = 0;
+			this->launch(order[next++]);
+			while (! __winner && __running != 0)
+			{
+				auto failures = __failures;
+				auto latest = order[next - 1];
+				__event.expires_at(
+					next < order.size()
+						? __attempts[latest].start + this->hedge_delay(__mirrors[latest])
+						: boost::asio::steady_timer::time_point::max()
+				);
+				auto [ec] = co_await __event.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+				if (__winner || next == order.size())
+					continue;
+				if (! ec)
+					std::clog << "hedge: no response from " << __mirrors[latest].str()
+						<< " yet, asking " << __mirrors[order[next]].str() << std::endl;
+				if (! ec || __failures != failures)
+					this->launch(order[next++]);
+			}
+			// the losers are cancelled, they still have to unwind
+			while (__running != 0)
+			{
+				__event.expires_at(boost::asio::steady_timer::time_point::max());
+				co_await __event.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+			}
+			if (! __winner)
+			{
+				// the last mirror asked says why
+				for (auto i = next; i-- != 0;)
+				{
+					if (__attempts[order[i]].error)
+						std::rethrow_exception(__attempts[order[i]].error);
+				}
+				throw std::runtime_error{"no mirror answered"};
+			}
+			auto & winner = __attempts[* __winner];
+			if (winner.error)
+				std::rethrow_exception(winner.error);
+			co_return winner.bytes;
+		}
+		const uget::url & winner() const
+		{
+			return __mirrors[__winner.value_or(0)];
+		}
+		unsigned status() const
+		{
+			return __winner ? __attempts[* __winner].status : 0;
+		}
+	private:
+		std::chrono::steady_clock::duration hedge_delay(const uget::url & url__) const
+		{
+			return uget::mirror_stats::shared().percentile(url__, 0.95).value_or(initial_delay);
+		}
+		void launch(std::size_t index__)
+		{
+			++__running;
+			__attempts[index__].start = std::chrono::steady_clock::now();
+			if (__mirrors[index__].secure)
+				boost::asio::co_spawn(__executor, this->attempt_on<uget::tls_client>(index__), boost::asio::detached);
+			else
+				boost::asio::co_spawn(__executor, this->attempt_on<uget::http_client>(index__), boost::asio::detached);
+		}
+		template<class Client>
+		boost::asio::awaitable<void> attempt_on(std::size_t index__)
+		{
+			const auto & url = __mirrors[index__];
+			auto client = std::make_shared<Client>(
+				url.host,
+				url.port,
+				url.target,
+				__executor,
+				__pool,
+				__monitor
+			);
+			client->decode(__decode);
+			__attempts[index__].cancel = [client]
+			{
+				client->cancel();
+			};
+			gate sink{* this, index__, [&client] { return client->status(); }};
+			try
+			{
+				__attempts[index__].bytes = co_await client->run_it(sink);
+				co_await client->finish();
+			}
+			catch (...)
+			{
+				__attempts[index__].error = std::current_exception();
+			}
+			__attempts[index__].status = client->status();
+			__attempts[index__].cancel = nullptr;
+			// a loser was dealt with in claim()
+			if (__attempts[index__].error && __winner.value_or(index__) == index__)
+			{
+				std::clog << "hedge: " << url.str() << " failed" << std::endl;
+				uget::mirror_stats::shared().fail(url);
+				++__failures;
+			}
+			--__running;
+			__event.cancel();
+		}
+		// the first request to reach the sink takes it, later ones are stopped
+		void claim(std::size_t index__)
+		{
+			if (__winner == index__)
+				return;
+			if (__winner)
+				throw std::system_error{std::make_error_code(std::errc::operation_canceled), "lost the hedge"};
+			__winner = index__;
+			auto now = std::chrono::steady_clock::now();
+			auto won = now - __attempts[index__].start;
+			uget::mirror_stats::shared().record(__mirrors[index__], won);
+			for (std::size_t i = 0; i < __attempts.size(); ++i)
+			{
+				// still running: launched, not yet finished
+				auto & other = __attempts[i];
+				if (i == index__ || ! other.cancel)
+					continue;
+				// A loser's own time is only known to be longer than what it
+				// waited. That is kept when it is at least the winner's, so a
+				// mirror that was asked first and lost drifts down; a hedge
+				// that lost a moment after it was sent says nothing.
+				if (now - other.start >= won)
+					uget::mirror_stats::shared().record(__mirrors[i], now - other.start);
+				other.cancel();
+			}
+			__event.cancel();
+		}
+	};
+
+	// --replay: an archive written by --record, served on loopback by a
+	// server in this process, on its own thread so it does not share the
+	// clients' event loop. Every host:port in the archive is pinned in the
+	// dns_cache to one of two listeners: plain http, or https with a
+	// certificate for the requested name made on the fly by a throwaway CA
+	// that the clients trust. A response waits for its recorded time to
+	// first byte, and its body is paced over its recorded transfer time,
+	// both times scale__; 0 serves at once.
+	class replay_server
+	{
+	private:
+		struct response
+		{
+			std::string_view header;
+			std::string_view body;
+			std::chrono::microseconds first_byte;
+			std::chrono::microseconds transfer;
+		};
+
+		// used on the server thread only
+		class credentials: virtual public Botan::Credentials_Manager
+		{
+		private:
+			uget::server::throwaway_ca __ca;
+			std::shared_ptr<Botan::Private_Key> __key;
+			std::map<std::string, Botan::X509_Certificate> __certificates;
+		public:
+			explicit credentials(Botan::RandomNumberGenerator & rng__):
+				__ca{"uget replay CA", rng__},
+				__key{uget::server::throwaway_ca::make_key(rng__)},
+				__certificates{}
+			{
+			}
+		public:
+			const Botan::X509_Certificate & ca() const
+			{
+				return __ca.cert();
+			}
+			// a certificate for whatever name the client asks for, made on the fly
+			std::vector<Botan::X509_Certificate> cert_chain(
+				const std::vector<std::string> & cert_key_types__,
+				const std::vector<Botan::AlgorithmIdentifier> &,
+				const std::string &,
+				const std::string & hostname__
+			) override
+			{
+				if (std::ranges::find(cert_key_types__, __key->algo_name()) == cert_key_types__.end())
+					return {};
+				auto name = hostname__.empty() ? "localhost"s : hostname__;
+				auto found = __certificates.find(name);
+				if (found == __certificates.end())
+					found = __certificates.emplace(name, __ca.issue({name}, * __key)).first;
+				return {found->second, __ca.cert()};
+			}
+			std::shared_ptr<Botan::Private_Key> private_key_for(
+				const Botan::X509_Certificate & certificate__,
+				const std::string &,
+				const std::string &
+			) override
+			{
+				if (certificate__ == __ca.cert())
+					return nullptr;
+				return __key;
+			}
+		};
+	private:
+		static constexpr std::size_t slice = 64 * 1024;
+	private:
+		uget::mapped_file __file;
+		std::map<std::string, response, std::less<>> __responses;
+		std::set<std::tuple<std::string, std::string, bool>> __hosts;
+		const double __scale;
+	private:
+		std::shared_ptr<Botan::RandomNumberGenerator> __rng;
+		std::shared_ptr<credentials> __credentials;
+		std::shared_ptr<Botan::TLS::Context> __context;
+	private:
+		boost::asio::io_context __io_context;
+		boost::asio::ip::tcp::acceptor __tls_acceptor;
+		boost::asio::ip::tcp::acceptor __tcp_acceptor;
+		std::thread __thread;
+	public:
+		replay_server(const std::filesystem::path & path__, double scale__):
+			__file{path__},
+			__responses{},
+			__hosts{},
+			__scale{std::max(scale__, 0.0)},
+
+			__rng{std::make_shared<Botan::AutoSeeded_RNG>()},
+			__credentials{std::make_shared<credentials>(* __rng)},
+			__context{std::make_shared<Botan::TLS::Context>(
+				__credentials,
+				__rng,
+				std::make_shared<Botan::TLS::Session_Manager_In_Memory>(__rng),
+				std::make_shared<Botan::TLS::Policy>()
+			)},
+
+			__io_context{1},
+			__tls_acceptor{__io_context, {boost::asio::ip::address_v4::loopback(), 0}},
+			__tcp_acceptor{__io_context, {boost::asio::ip::address_v4::loopback(), 0}},
+			__thread{}
+		{
+			this->load(path__);
+		}
+		replay_server(const replay_server &) = delete;
+		replay_server & operator=(const replay_server &) = delete;
+		~replay_server()
+		{
+			__io_context.stop();
+			if (__thread.joinable())
+				__thread.join();
+		}
+	public:
+		// call before any client starts
+		void start()
+		{
+			for (const auto & [host, port, secure]: __hosts)
+			{
+				auto & acceptor = secure ? __tls_acceptor : __tcp_acceptor;
+				uget::dns_cache::shared().pin(host, port, {acceptor.local_endpoint()});
+			}
+			uget::credentials_manager::trust(__credentials->ca());
+
+			boost::asio::co_spawn(__io_context, this->listen(__tls_acceptor, true), boost::asio::detached);
+			boost::asio::co_spawn(__io_context, this->listen(__tcp_acceptor, false), boost::asio::detached);
+			__thread = std::thread{[this] { __io_context.run(); }};
+			std::clog << "replay: " << __responses.size() << " responses for " << __hosts.size()
+				<< " hosts, latency x" << __scale << std::endl;
+		}
+	private:
+		// "<method> <scheme> <host> <port> <target> <range or ->"; on the serving
+		// side the scheme is the listener's and the port is the Host header's
+		static std::string key(
+			std::string_view method__,
+			bool secure__,
+			std::string_view host__,
+			std::string_view port__,
+			std::string_view target__,
+			std::string_view range__
+		)
+		{
+			return std::string{method__} + ' '
+				+ std::string{secure__ ? uget::tls_transport::scheme : uget::tcp_transport::scheme} + ' '
+				+ std::string{host__} + ' ' + std::string{port__} + ' '
+				+ std::string{target__} + ' ' + uget::archive::range(range__);
+		}
+		void load(const std::filesystem::path & path__)
+		{
+			std::string_view data{__file.data(), __file.size()};
+			if (! data.starts_with(uget::archive::magic))
+				throw std::runtime_error{path__.string() + " is not a uget archive"};
+			std::size_t at = uget::archive::magic.size();
+			while (at < data.size())
+			{
+				auto end = data.find('\n', at);
+				if (end == std::string_view::npos)
+					break;
+				std::istringstream line{std::string{data.substr(at, end - at)}};
+				std::string mark, method, text, range;
+				long long first_byte = 0, transfer = 0;
+				std::size_t header = 0, body = 0;
+				if (! (line >> mark >> method >> text >> range >> first_byte >> transfer >> header >> body) || mark != "@")
+					throw std::runtime_error{path__.string() + ": damaged record at offset " + std::to_string(at)};
+				at = end + 1;
+				// the last record of a run that was killed while writing it
+				if (data.size() - at < header + body)
+					break;
+				if (auto url = uget::url::parse(text))
+				{
+					__responses.insert_or_assign(
+						key(method, url->secure, url->host, url->port, url->target, range == "-" ? "" : range),
+						response{
+							data.substr(at, header),
+							data.substr(at + header, body),
+							std::chrono::microseconds(first_byte),
+							std::chrono::microseconds(transfer)
+						}
+					);
+					__hosts.emplace(url->host, url->port, url->secure);
+				}
+				at += header + body;
+			}
+		}
+		boost::asio::awaitable<void> listen(boost::asio::ip::tcp::acceptor & acceptor__, bool secure__)
+		{
+			co_await uget::server::accept_loop(
+				acceptor__,
+				[this, secure__] (boost::asio::ip::tcp::socket socket__)
+				{
+					auto executor = socket__.get_executor();
+					if (secure__)
+						boost::asio::co_spawn(executor, this->session_tls(std::move(socket__)), boost::asio::detached);
+					else
+						boost::asio::co_spawn(executor, this->session_tcp(std::move(socket__)), boost::asio::detached);
+				}
+			);
+		}
+		boost::asio::awaitable<void> session_tls(boost::asio::ip::tcp::socket socket__)
+		{
+			Botan::TLS::Stream<boost::beast::tcp_stream> stream{__context, std::move(socket__)};
+			co_await uget::server::serve_tls(
+				stream,
+				[this, &stream] (const uget::server::request_type & request__)
+				{
+					return this->respond(stream, request__, true);
+				}
+			);
+		}
+		boost::asio::awaitable<void> session_tcp(boost::asio::ip::tcp::socket socket__)
+		{
+			boost::beast::tcp_stream stream{std::move(socket__)};
+			co_await uget::server::serve_requests(
+				stream,
+				[this, &stream] (const uget::server::request_type & request__)
+				{
+					return this->respond(stream, request__, false);
+				}
+			);
+			boost::system::error_code ec;
+			stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+		}
+		template<class Stream>
+		boost::asio::awaitable<bool> respond(
+			Stream & stream__,
+			const uget::server::request_type & request__,
+			bool secure__
+		)
+		{
+			// "host", "host:port", "[v6]" or "[v6]:port"
+			std::string_view host = request__[boost::beast::http::field::host];
+			std::string_view port = secure__ ? uget::tls_transport::default_port : uget::tcp_transport::default_port;
+			auto colon = host.rfind(':');
+			if (host.starts_with('['))
+				colon = host.find("]:") == std::string_view::npos ? std::string_view::npos : host.find("]:") + 1;
+			if (colon != std::string_view::npos)
+			{
+				port = host.substr(colon + 1);
+				host = host.substr(0, colon);
+			}
+			if (host.starts_with('[') && host.ends_with(']'))
+				host = host.substr(1, host.size() - 2);
+			auto found = __responses.find(key(
+				request__.method_string(),
+				secure__,
+				host,
+				port,
+				request__.target(),
+				request__[boost::beast::http::field::range]
+			));
+			boost::beast::get_lowest_layer(stream__).expires_after(std::chrono::seconds(30));
+			if (found == __responses.end())
+			{
+				boost::beast::http::response<boost::beast::http::string_body> missing{
+					boost::beast::http::status::not_found,
+					request__.version()
+				};
+				missing.keep_alive(request__.keep_alive());
+				missing.body() = "not in the archive\n";
+				missing.prepare_payload();
+				auto [ec, bytes] = co_await boost::beast::http::async_write(
+					stream__,
+					missing,
+					boost::asio::as_tuple(boost::asio::use_awaitable)
+				);
+				co_return ! ec;
+			}
+			const auto & recorded = found->second;
+			auto start = std::chrono::steady_clock::now();
+			co_await this->pause(start, recorded.first_byte);
+
+			boost::beast::http::response_parser<boost::beast::http::empty_body> parser;
+			boost::system::error_code ec;
+			parser.put(boost::asio::buffer(recorded.header.data(), recorded.header.size()), ec);
+			if (! parser.is_header_done())
+				co_return false;
+			boost::beast::http::response<boost::beast::http::buffer_body> response{std::move(parser.get().base())};
+			bool head = request__.method() == boost::beast::http::verb::head;
+			if (! head)
+			{
+				// the body was recorded without its chunking
+				response.erase(boost::beast::http::field::transfer_encoding);
+				response.content_length(recorded.body.size());
+			}
+			response.keep_alive(request__.keep_alive());
+			response.body().data = nullptr;
+			response.body().more = ! head && ! recorded.body.empty();
+
+			boost::beast::http::response_serializer<boost::beast::http::buffer_body> serializer{response};
+			std::tie(ec, std::ignore) = co_await boost::beast::http::async_write_header(
+				stream__,
+				serializer,
+				boost::asio::as_tuple(boost::asio::use_awaitable)
+			);
+			if (ec || head)
+				co_return ! ec;
+
+			auto first_byte = std::chrono::steady_clock::now();
+			for (std::size_t sent = 0; sent < recorded.body.size();)
+			{
+				auto n = std::min(slice, recorded.body.size() - sent);
+				response.body().data = const_cast<char *>(recorded.body.data() + sent);
+				response.body().size = n;
+				response.body().more = sent + n != recorded.body.size();
+				boost::beast::get_lowest_layer(stream__).expires_after(std::chrono::seconds(30));
+				std::tie(ec, std::ignore) = co_await boost::beast::http::async_write(
+					stream__,
+					serializer,
+					boost::asio::as_tuple(boost::asio::use_awaitable)
+				);
+				if (ec == boost::beast::http::error::need_buffer)
+					ec = {};
+				if (ec)
+					co_return false;
+				sent += n;
+				// where the recorded transfer was at this many bytes
+				co_await this->pause(first_byte, recorded.transfer * (static_cast<double>(sent) / recorded.body.size()));
+			}
+			co_return true;
+		}
+		// until base__ + recorded__, scaled
+		boost::asio::awaitable<void> pause(
+			std::chrono::steady_clock::time_point base__,
+			std::chrono::duration<double, std::micro> recorded__
+		)
+		{
+			if (__scale == 0)
+				co_return;
+			auto until = base__ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(recorded__ * __scale);
+			if (until <= std::chrono::steady_clock::now())
+				co_return;
+			boost::asio::steady_timer timer{__io_context};
+			timer.expires_at(until);
+			co_await timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+		}
+	};
+
+	// One io_context per shard, each run by its own thread, so the TLS
+	// records of different connections are sealed and opened on different
+	// cores. A (host, port) belongs to one shard, picked by its hash: its
+	// connections sit in that shard's pool and its requests run on that
+	// shard's thread, so pools, per-host caps and clients stay single
+	// threaded. The process-wide caches (dns, tls, rate limits, mirror
+	// stats, integrity) lock for themselves.
+	//
+	// submit() is the way in from any thread: the work is posted onto the
+	// owning shard's io_context, whose handler queue is the cross-shard
+	// queue. One host never spreads over shards; the load test drives
+	// every shard directly to measure the engine itself.
+	class engine
+	{
+	public:
+		class shard
+		{
+		private:
+			const std::size_t __index;
+			boost::asio::io_context __io_context;
+			uget::connection_pool __pool;
+		public:
+			explicit shard(std::size_t index__):
+				__index{index__},
+				__io_context{1},
+				__pool{}
+			{
+			}
+		public:
+			std::size_t index() const
+			{
+				return __index;
+			}
+			boost::asio::any_io_executor executor()
+			{
+				return __io_context.get_executor();
+			}
+			boost::asio::io_context & io_context()
+			{
+				return __io_context;
+			}
+			uget::connection_pool & pool()
+			{
+				return __pool;
+			}
+		};
+	private:
+		std::vector<std::unique_ptr<shard>> __shards;
+		std::vector<std::thread> __threads;
+	private:
+		std::mutex __mutex;
+		std::size_t __running;
+		std::exception_ptr __error;
+		std::function<void()> __done;
+	public:
+		// shards__ 0 is one per core
+		explicit engine(std::size_t shards__):
+			__shards{},
+			__threads{},
+			__mutex{},
+			__running{0},
+			__error{},
+			__done{}
+		{
+			if (shards__ == 0)
+				shards__ = std::max(std::thread::hardware_concurrency(), 1u);
+			for (std::size_t i = 0; i < shards__; ++i)
+				__shards.push_back(std::make_unique<shard>(i));
+		}
+		engine(const engine &) = delete;
+		engine & operator=(const engine &) = delete;
+		~engine()
+		{
+			for (auto & shard: __shards)
+				shard->io_context().stop();
+			for (auto & thread: __threads)
+			{
+				if (thread.joinable())
+					thread.join();
+			}
+		}
+	public:
+		std::size_t size() const
+		{
+			return __shards.size();
+		}
+		shard & at(std::size_t index__)
+		{
+			return * __shards.at(index__);
+		}
+		std::size_t index(const std::string_view host__, const std::string_view port__) const
+		{
+			return std::hash<std::string>{}(uget::connection_pool::key(host__, port__)) % __shards.size();
+		}
+		// function__(shard &) later, on the thread of the shard that owns host__:port__
+		template<class Function>
+		void submit(const std::string_view host__, const std::string_view port__, Function function__)
+		{
+			auto & owner = * __shards[this->index(host__, port__)];
+			boost::asio::post(
+				owner.executor(),
+				[&owner, function = std::move(function__)] mutable
+				{
+					function(owner);
+				}
+			);
+		}
+	public:
+		// co_spawns main__(shard &) on every shard and starts their threads;
+		// done__ runs on the thread of the shard that finishes last
+		template<class Main>
+		void start(Main main__, std::function<void()> done__ = {})
+		{
+			__running = __shards.size();
+			__done = std::move(done__);
+			for (auto & shard: __shards)
+			{
+				boost::asio::co_spawn(
+					shard->executor(),
+					[main__, &owner = * shard]
+					{
+						return main__(owner);
+					},
+					[this] (std::exception_ptr error__)
+					{
+						this->finished(error__);
+					}
+				);
+			}
+			for (auto & shard: __shards)
+				__threads.emplace_back([&io_context = shard->io_context()] { io_context.run(); });
+		}
+		// waits for every shard to run out of work; rethrows the first error
+		void join()
+		{
+			for (auto & thread: __threads)
+				thread.join();
+			__threads.clear();
+			if (__error)
+				std::rethrow_exception(__error);
+		}
+	private:
+		void finished(std::exception_ptr error__)
+		{
+			std::function<void()> done;
+			{
+				std::lock_guard lock{__mutex};
+				if (error__ && ! __error)
+					__error = error__;
+				if (--__running == 0)
+					done = std::move(__done);
+			}
+			if (done)
+				done();
+		}
+	};
+
+	// Fetches a list of urls with at most __jobs requests in flight,
+	// and at most __per_host of them against the same (host, port).
+	// Every worker is a coroutine on the same executor, so no locking.
+	// On an engine there is one batch per shard, fed through submit().
+	//
+	// As a crawler it also follows the links of every HTML page it gets,
+	// up to __crawl_depth away from the seeds and only below a seed's
+	// directory. New links go through the seen_set and into the host's
+	// bounded frontier; at most __crawl_limit urls are ever taken in.
+	//
+	// A url line may carry the body's SHA-256 after the url; it is checked
+	// as the body streams in and a mismatch fails the batch.
+	class batch
+	{
+	private:
+		std::map<std::string, uget::frontier> __pending;
+		std::map<std::string, std::size_t> __active;
+		std::size_t __pending_count;
+		std::size_t __in_flight;
+		std::size_t __dropped;
+		std::string __cursor;
+		std::map<std::string, std::string, std::less<>> __expected;
+		std::map<std::string, std::vector<uget::url>, std::less<>> __mirrors;
+		std::size_t __mismatches;
+		bool __open;
+	private:
+		const std::size_t __jobs;
+		const std::size_t __per_host;
+		const std::filesystem::path __output_dir;
+		bool __decode;
+	private:
+		boost::asio::steady_timer __wakeup;
+		boost::asio::steady_timer __done;
+		std::size_t __workers;
+	private:
+		std::size_t __crawl_depth;
+		std::size_t __crawl_limit;
+		std::size_t __frontier_limit;
+		std::vector<std::string> __scope;
+		std::unique_ptr<uget::seen_set> __seen;
+	private:
+		uget::connection_pool & __pool;
+		uget::net_monitor & __monitor;
+	public:
+		batch(
+			boost::asio::any_io_executor executor__,
+			std::size_t jobs__,
+			std::size_t per_host__,
+			const std::filesystem::path & output_dir__,
+			uget::connection_pool & pool__,
+			uget::net_monitor & monitor__
+		):
+			__pending{},
+			__active{},
+			__pending_count{0},
+			__in_flight{0},
+			__dropped{0},
+			__cursor{},
+			__expected{},
+			__mirrors{},
+			__mismatches{0},
+			__open{false},
+
+			__jobs{std::max<std::size_t>(jobs__, 1)},
+			__per_host{std::max<std::size_t>(per_host__, 1)},
+			__output_dir{output_dir__},
+			__decode{true},
+
+			__wakeup{executor__, boost::asio::steady_timer::time_point::max()},
+			__done{executor__, boost::asio::steady_timer::time_point::max()},
+			__workers{0},
+
+			__crawl_depth{0},
+			__crawl_limit{0},
+			__frontier_limit{std::numeric_limits<std::size_t>::max()},
+			__scope{},
+			__seen{},
+
+			__pool{pool__},
+			__monitor{monitor__}
+		{
+		}
+	public:
+		// one line of the url list
+		struct entry
+		{
+			std::vector<uget::url> mirrors;
+			std::string expected;
+		};
+	public:
+		void decode(bool decode__)
+		{
+			__decode = decode__;
+		}
+		// workers wait for more urls after run() has started, until close()
+		void hold()
+		{
+			__open = true;
+		}
+		void close()
+		{
+			__open = false;
+			__wakeup.cancel();
+		}
+		// follow links depth__ steps from the seeds; call before adding them
+		void crawl(std::size_t depth__, std::size_t limit__, std::size_t frontier__)
+		{
+			__crawl_depth = depth__;
+			__crawl_limit = std::max<std::size_t>(limit__, 1);
+			__frontier_limit = frontier__;
+			__seen = std::make_unique<uget::seen_set>(
+				__crawl_limit,
+				uget::cache_dir() / "crawl" / ("seen-" + std::to_string(::getpid()))
+			);
+		}
+	public:
+		void add(const uget::url & url__)
+		{
+			if (__seen)
+			{
+				if (! __seen->insert(url__.str()))
+					return;
+				auto scope = url__;
+				scope.target.erase(scope.target.find('?') == std::string::npos ? scope.target.size() : scope.target.find('?'));
+				scope.target.erase(scope.target.rfind('/') + 1);
+				__scope.push_back(scope.str());
+			}
+			this->push(url__, 0);
+		}
+		void add(const entry & entry__)
+		{
+			auto key = entry__.mirrors.front().str();
+			if (! entry__.expected.empty())
+				__expected.insert_or_assign(key, entry__.expected);
+			if (entry__.mirrors.size() > 1)
+				__mirrors.insert_or_assign(key, entry__.mirrors);
+			this->add(entry__.mirrors.front());
+		}
+		std::size_t add(std::istream & in__)
+		{
+			std::size_t count = 0;
+			std::string line;
+			while (std::getline(in__, line))
+			{
+				if (auto entry = parse(line))
+				{
+					this->add(* entry);
+					++count;
+				}
+			}
+			return count;
+		}
+		// one object per line: its url, then the urls of mirrors that have
+		// the same object, then optionally its sha256;
+		// blank lines and # comments are skipped
+		static std::optional<entry> parse(const std::string & line__)
+		{
+			auto first = line__.find_first_not_of(" \t\r");
+			if (first == std::string::npos || line__[first] == '#')
+				return std::nullopt;
+			std::istringstream words{line__};
+			entry result;
+			for (std::string word; result.expected.empty() && words >> word;)
+			{
+				if (auto parsed = uget::url::parse(word))
+					result.mirrors.push_back(* parsed);
+				else
+					result.expected = word;
+			}
+			if (result.mirrors.empty())
+			{
+				std::clog << "batch: skip unsupported url: " << result.expected << std::endl;
+				return std::nullopt;
+			}
+			if (! result.expected.empty())
+				uget::integrity::shared().require("SHA-256");
+			return result;
+		}
+	public:
+		boost::asio::awaitable<void> run()
+		{
+			auto executor = co_await boost::asio::this_coro::executor;
+			// a crawl starts from a few seeds and grows, a held batch from none
+			std::size_t workers = __seen || __open ? __jobs : std::min(__jobs, __pending_count);
+			for (std::size_t i = 0; i < workers; ++i)
+			{
+				++__workers;
+				boost::asio::co_spawn(
+					executor,
+					[this] -> boost::asio::awaitable<void>
+					{
+						co_await this->work();
+						if (--__workers == 0)
+							__done.cancel();
+					},
+					boost::asio::detached
+				);
+			}
+			if (__workers != 0)
+				co_await __done.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+			if (__seen)
+				std::clog << "crawl: " << __seen->size() << " urls taken in, "
+					<< __dropped << " dropped from full frontiers" << std::endl;
+			if (__mismatches != 0)
+				std::clog << "batch: " << __mismatches << " bodies failed their sha256" << std::endl;
+		}
+		bool verified() const
+		{
+			return __mismatches == 0;
+		}
+	private:
+		boost::asio::awaitable<void> work()
+		{
+			// while crawling, a fetch in flight may still bring new urls
+			while (__pending_count != 0 || (__seen && __in_flight != 0) || __open)
+			{
+				auto next = this->next();
+				if (! next)
+				{
+					// every pending host is at its cap, wait for a slot to free up
+					// or, while held, for more urls
+					co_await __wakeup.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+					continue;
+				}
+				auto key = uget::connection_pool::key(next->url.host, next->url.port);
+				++__active[key];
+				++__in_flight;
+				co_await this->fetch(* next);
+				--__in_flight;
+				if (--__active[key] == 0)
+					__active.erase(key);
+				__wakeup.cancel();
+			}
+		}
+		void push(const uget::url & url__, std::size_t depth__)
+		{
+			auto & frontier = __pending.try_emplace(
+				uget::connection_pool::key(url__.host, url__.port),
+				__frontier_limit
+			).first->second;
+			auto before = frontier.size();
+			frontier.push(url__, depth__);
+			if (frontier.size() == before)
+				++__dropped;
+			else
+				++__pending_count;
+			__wakeup.cancel();
+		}
+		// a link on a page at depth__ - 1
+		void found(std::optional<uget::url> url__, std::size_t depth__)
+		{
+			if (! url__)
+				return;
+			auto text = url__->str();
+			if (std::ranges::none_of(__scope, [&text] (const std::string & prefix) { return text.starts_with(prefix); }))
+				return;
+			if (__seen->size() >= __crawl_limit || ! __seen->insert(text))
+				return;
+			this->push(* url__, depth__);
+		}
+		// round robin over hosts that are below the per-host cap
+		std::optional<uget::frontier::item> next()
+		{
+			auto start = __pending.upper_bound(__cursor);
+			for (std::size_t i = 0; i < __pending.size(); ++i, ++start)
+			{
+				if (start == __pending.end())
+					start = __pending.begin();
+				auto active = __active.find(start->first);
+				if (active != __active.end() && active->second >= __per_host)
+					continue;
+
+				auto result = start->second.pop();
+				--__pending_count;
+				__cursor = start->first;
+				if (start->second.empty())
+					__pending.erase(start);
+				return result;
+			}
+			return std::nullopt;
+		}
+		boost::asio::awaitable<void> fetch(const uget::frontier::item & item__)
+		{
+			if (auto mirrors = __mirrors.find(item__.url.str()); mirrors != __mirrors.end())
+				co_await this->fetch_hedged(mirrors->second);
+			else if (item__.url.secure)
+				co_await this->fetch<uget::tls_client>(item__);
+			else
+				co_await this->fetch<uget::http_client>(item__);
+		}
+		// the per-host cap counts the first mirror only
+		boost::asio::awaitable<void> fetch_hedged(const std::vector<uget::url> & mirrors__)
+		{
+			const auto & url__ = mirrors__.front();
+			auto begin = std::chrono::steady_clock::now();
+			try
+			{
+				auto sink = this->sink(url__);
+				auto hashes = this->hashes(* sink);
+				uget::hedged_fetch hedged{
+					co_await boost::asio::this_coro::executor,
+					mirrors__,
+					hashes ? * hashes : * sink,
+					__pool,
+					__monitor
+				};
+				hedged.decode(__decode);
+				auto bytes = co_await hedged.run();
+
+				auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - begin
+				);
+				std::osyncstream{std::cout} << hedged.status() << ' ' << bytes << ' '
+					<< ms.count() << "ms " << url__.str() << " from " << hedged.winner().str() << std::endl;
+				if (hashes)
+					this->verify(url__, * hashes);
+			}
+			catch (const std::exception & e)
+			{
+				std::osyncstream{std::cout} << "error " << url__.str() << ": " << e.what() << std::endl;
+			}
+		}
+		template<class Client>
+		boost::asio::awaitable<void> fetch(const uget::frontier::item & item__)
+		{
+			const auto & url__ = item__.url;
+			auto begin = std::chrono::steady_clock::now();
+			try
+			{
+				auto client = std::make_shared<Client>(
+					url__.host,
+					url__.port,
+					url__.target,
+					co_await boost::asio::this_coro::executor,
+					__pool,
+					__monitor
+				);
+				client->decode(__decode);
+				auto sink = this->sink(url__);
+				auto hashes = this->hashes(* sink);
+				uget::body_sink & body = hashes ? * hashes : * sink;
+
+				std::unique_ptr<uget::body_sink> links;
+				if (__seen && item__.depth < __crawl_depth)
+				{
+					links = std::make_unique<uget::link_sink>(
+						body,
+						[&client]
+						{
+							return boost::beast::iequals(client->content_type().substr(0, 9), "text/html");
+						},
+						[this, &item__, base = item__.url] (std::string_view tag, std::string_view link) mutable
+						{
+							if (tag == "base")
+							{
+								if (auto url = item__.url.resolve(link))
+									base = * url;
+								return;
+							}
+							this->found(base.resolve(link), item__.depth + 1);
+						}
+					);
+				}
+
+				auto bytes = co_await client->run_it(links ? * links : body);
+				co_await client->finish();
+
+				if (hashes)
+					this->verify(url__, * hashes);
+
+				auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - begin
+				);
+				std::osyncstream{std::cout} << client->status() << ' ' << bytes << ' '
+					<< ms.count() << "ms " << url__.str() << std::endl;
+			}
+			catch (const std::exception & e)
+			{
+				std::osyncstream{std::cout} << "error " << url__.str() << ": " << e.what() << std::endl;
+			}
+		}
+		std::unique_ptr<uget::body_sink> sink(const uget::url & url__)
+		{
+			if (__output_dir.empty())
+				return std::make_unique<uget::null_sink>();
+			return uget::make_file_sink(__wakeup.get_executor(), __output_dir / url__.file_name());
+		}
+		std::unique_ptr<uget::hash_sink> hashes(uget::body_sink & sink__)
+		{
+			const auto & algorithms = uget::integrity::shared().algorithms();
+			if (algorithms.empty())
+				return nullptr;
+			return std::make_unique<uget::hash_sink>(sink__, algorithms);
+		}
+		void verify(const uget::url & url__, const uget::hash_sink & hashes__)
+		{
+			auto expected = __expected.find(url__.str());
+			bool ok = uget::integrity::shared().check(
+				__output_dir.empty() ? url__.str() : (__output_dir / url__.file_name()).string(),
+				hashes__.digests(),
+				"SHA-256",
+				expected == __expected.end() ? ""s : expected->second
+			);
+			if (! ok)
+				++__mismatches;
+		}
+	};
+
+	// Splits one object into byte ranges fetched on separate connections
+	// and written at their offsets. Progress goes to <output>.uget-state
+	// so an interrupted download only fetches what is still missing.
+	class segmented_download
+	{
+	private:
+		struct segment
+		{
+			std::uint64_t begin;
+			std::uint64_t end;	// exclusive
+			std::uint64_t done;
+			std::uint64_t saved;
+		public:
+			std::uint64_t size() const
+			{
+				return end - begin;
+			}
+		};
+
+		// checks the 206 before the first byte lands in the file
+		template<class Client>
+		class segment_sink: virtual public uget::body_sink
+		{
+		private:
+			uget::segmented_download & __download;
+			segment & __segment;
+			Client & __client;
+			uget::file_sink __file;
+			bool __checked;
+		public:
+			segment_sink(
+				uget::segmented_download & download__,
+				segment & segment__,
+				Client & client__
+			):
+				__download{download__},
+				__segment{segment__},
+				__client{client__},
+				__file{
+					download__.__path,
+					boost::beast::file_mode::write_existing,
+					segment__.begin + segment__.done
+				},
+				__checked{false}
+			{
+			}
+		public:
+			boost::asio::awaitable<void> write(boost::asio::const_buffer data__) override
+			{
+				if (! __checked)
+				{
+					__download.check_range(__client, __segment.begin + __segment.done);
+					__checked = true;
+				}
+				auto room = __segment.size() - __segment.done;
+				if (data__.size() > room)
+					throw std::runtime_error{"server sent more than the requested range"};
+
+				co_await __file.write(data__);
+				__segment.done += data__.size();
+				if (__segment.done - __segment.saved >= save_every)
+					__download.save_state();
+			}
+			boost::asio::awaitable<void> close() override
+			{
+				co_await __file.close();
+			}
+		};
+	private:
+		static constexpr std::uint64_t save_every = 4 * 1024 * 1024;
+		static constexpr int max_attempts = 3;
+	private:
+		const uget::url __url;
+		const std::filesystem::path __path;
+		const std::filesystem::path __state_path;
+		const std::size_t __count;
+	private:
+		std::uint64_t __length;
+		std::string __validator;
+		std::vector<segment> __segments;
+	private:
+		boost::asio::steady_timer __done;
+		std::size_t __running;
+		std::exception_ptr __error;
+	private:
+		uget::connection_pool & __pool;
+		uget::net_monitor & __monitor;
+	public:
+		segmented_download(
+			boost::asio::any_io_executor executor__,
+			const uget::url & url__,
+			const std::filesystem::path & path__,
+			std::size_t count__,
+			uget::connection_pool & pool__,
+			uget::net_monitor & monitor__
+		):
+			__url{url__},
+			__path{path__},
+			__state_path{path__.string() + ".uget-state"},
+			__count{std::max<std::size_t>(count__, 1)},
+
+			__length{0},
+			__validator{},
+			__segments{},
+
+			__done{executor__, boost::asio::steady_timer::time_point::max()},
+			__running{0},
+			__error{},
+
+			__pool{pool__},
+			__monitor{monitor__}
+		{
+		}
+	public:
+		// returns false when the server can not do ranges, the caller then
+		// falls back to one plain stream
+		boost::asio::awaitable<bool> run()
+		{
+			if (__url.secure)
+				co_return co_await this->run<uget::tls_client>();
+			co_return co_await this->run<uget::http_client>();
+		}
+	private:
+		template<class Client>
+		boost::asio::awaitable<bool> run()
+		{
+			if (! co_await this->probe<Client>())
+				co_return false;
+
+			if (! this->load_state())
+			{
+				this->split();
+				std::ofstream{__path, std::ios::binary | std::ios::trunc};
+				std::filesystem::resize_file(__path, __length);
+				this->save_state();
+			}
+
+			auto executor = co_await boost::asio::this_coro::executor;
+			for (auto & seg: __segments)
+			{
+				if (seg.done == seg.size())
+					continue;
+				++__running;
+				boost::asio::co_spawn(
+					executor,
+					[this, &seg] -> boost::asio::awaitable<void>
+					{
+						try
+						{
+							co_await this->fetch<Client>(seg);
+						}
+						catch (...)
+						{
+							if (! __error)
+								__error = std::current_exception();
+						}
+						if (--__running == 0)
+							__done.cancel();
+					},
+					boost::asio::detached
+				);
+			}
+			if (__running != 0)
+				co_await __done.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+
+			this->save_state();
+			if (__error)
+				std::rethrow_exception(__error);
+
+			std::filesystem::remove(__state_path);
+			std::clog << "segmented: " << __length << " bytes in "
+				<< __segments.size() << " segments" << std::endl;
+			co_return true;
+		}
+		template<class Client>
+		boost::asio::awaitable<bool> probe()
+		{
+			auto client = std::make_shared<Client>(
+				__url.host,
+				__url.port,
+				__url.target,
+				co_await boost::asio::this_coro::executor,
+				__pool,
+				__monitor
+			);
+			client->request().method(boost::beast::http::verb::head);
+			client->decode(false);
+			uget::null_sink sink;
+			co_await client->run_it(sink);
+			co_await client->finish();
+
+			const auto & header = client->header();
+			if (client->status() != 200)
+				co_return false;
+			if (header[boost::beast::http::field::accept_ranges] != "bytes")
+				co_return false;
+			auto length = header[boost::beast::http::field::content_length];
+			auto [ptr, ec] = std::from_chars(length.data(), length.data() + length.size(), __length);
+			if (ec != std::errc{} || __length == 0)
+				co_return false;
+
+			// only a strong validator can go into If-Range
+			std::string_view etag = header[boost::beast::http::field::etag];
+			if (! etag.empty() && ! etag.starts_with("W/"))
+				__validator = etag;
+			else
+				__validator = header[boost::beast::http::field::last_modified];
+			co_return true;
+		}
+		void split()
+		{
+			auto count = std::min<std::uint64_t>(__count, __length);
+			auto step = __length / count;
+			__segments.clear();
+			for (std::uint64_t i = 0; i < count; ++i)
+			{
+				auto begin = i * step;
+				auto end = i + 1 == count ? __length : begin + step;
+				__segments.push_back({begin, end, 0, 0});
+			}
+		}
+		template<class Client>
+		boost::asio::awaitable<void> fetch(segment & seg__)
+		{
+			for (int attempt = 1; seg__.done < seg__.size(); ++attempt)
+			{
+				auto client = std::make_shared<Client>(
+					__url.host,
+					__url.port,
+					__url.target,
+					co_await boost::asio::this_coro::executor,
+					__pool,
+					__monitor
+				);
+				client->decode(false);
+				auto & request = client->request();
+				request.set(
+					boost::beast::http::field::range,
+					"bytes="s + std::to_string(seg__.begin + seg__.done) + '-' + std::to_string(seg__.end - 1)
+				);
+				if (! __validator.empty())
+					request.set(boost::beast::http::field::if_range, __validator);
+
+				try
+				{
+					segment_sink<Client> sink{* this, seg__, * client};
+					co_await client->run_it(sink);
+					co_await client->finish();
+				}
+				catch (const std::system_error & e)
+				{
+					if (attempt >= max_attempts)
+						throw;
+					std::clog << "segmented: segment at " << seg__.begin << " failed ("
+						<< e.what() << "), resuming at " << seg__.begin + seg__.done << std::endl;
+				}
+				this->save_state();
+			}
+		}
+		template<class Client>
+		void check_range(Client & client__, std::uint64_t offset__)
+		{
+			if (client__.status() != 206)
+				throw std::runtime_error{"range request answered with "s
+					+ std::to_string(client__.status()) + ", the object changed on the server?"};
+			// bytes <first>-<last>/<length>
+			std::string_view range = client__.header()[boost::beast::http::field::content_range];
+			std::uint64_t first = 0;
+			if (range.starts_with("bytes "))
+				range.remove_prefix(6);
+			auto [ptr, ec] = std::from_chars(range.data(), range.data() + range.size(), first);
+			if (ec != std::errc{} || first != offset__)
+				throw std::runtime_error{"unexpected Content-Range: "s + std::string{range}};
+		}
+	private:
+		bool load_state()
+		{
+			std::ifstream in{__state_path};
+			if (! in)
+				return false;
+
+			std::string magic, url, validator;
+			std::uint64_t length = 0;
+			std::size_t count = 0;
+			in >> magic >> std::quoted(url) >> length >> std::quoted(validator) >> count;
+			if (! in || magic != "uget-segments-1" || url != __url.str()
+				|| length != __length || validator != __validator
+				|| ! std::filesystem::exists(__path))
+			{
+				std::clog << "segmented: stale state file, starting over" << std::endl;
+				return false;
+			}
+
+			std::vector<segment> segments(count);
+			for (auto & seg: segments)
+			{
+				in >> seg.begin >> seg.end >> seg.done;
+				seg.saved = seg.done;
+				if (! in || seg.end > __length || seg.begin + seg.done > seg.end)
+					return false;
+			}
+			__segments = std::move(segments);
+
+			std::uint64_t remaining = 0;
+			for (const auto & seg: __segments)
+				remaining += seg.size() - seg.done;
+			std::clog << "segmented: resuming, " << remaining << " of "
+				<< __length << " bytes left" << std::endl;
+			return true;
+		}
+		// written next to the target and renamed, so it is never half written
+		void save_state()
+		{
+			auto temp = __state_path;
+			temp += ".tmp";
+			{
+				std::ofstream out{temp, std::ios::trunc};
+				out << "uget-segments-1 " << std::quoted(__url.str()) << ' ' << __length << ' '
+					<< std::quoted(__validator) << ' ' << __segments.size() << '\n';
+				for (const auto & seg: __segments)
+					out << seg.begin << ' ' << seg.end << ' ' << seg.done << '\n';
+				if (! out)
+					throw std::runtime_error{"can not write " + temp.string()};
+			}
+			std::filesystem::rename(temp, __state_path);
+			for (auto & seg: __segments)
+				seg.saved = seg.done;
+		}
+	};
+
+	// HTTP/1.1 pipelining against one host: up to __depth GETs are written
+	// back to back before their responses are read, in order, and every
+	// response read makes room for the next request. Writes only happen
+	// between reads, so the TLS stream never has two operations at once.
+	// If the server closes with requests still unanswered, those go back
+	// to the queue and the rest runs on a new connection without pipelining.
+	class pipeline
+	{
+	public:
+		// gives the sink for one target; called right before its response is read
+		using sink_factory = std::function<uget::body_sink & (const std::string &)>;
+	private:
+		const std::string __host;
+		const std::string __port;
+		std::size_t __depth;
+		bool __decode;
+		bool __secure;
+		std::deque<std::string> __pending;
+		sink_factory __sinks;
+		// targets whose body broke off halfway, run() fails with them at the end
+		std::vector<std::string> __abandoned;
 	private:
-		uget::net_monitor::signal_type __signal;
+		boost::asio::any_io_executor __executor;
+		uget::connection_pool & __pool;
 		uget::net_monitor & __monitor;
 	public:
-		virtual ~tls_client()
-		{
-			this->signal("tls_client destructor is called");
-		}
-	public:
-		tls_client(
+		pipeline(
+			boost::asio::any_io_executor executor__,
 			const std::string_view host__,
 			const std::string_view port__,
-			const std::string_view uri__,
-			boost::asio::any_io_executor executor__,
+			const std::vector<std::string> & targets__,
+			std::size_t depth__,
+			sink_factory sinks__,
+			uget::connection_pool & pool__,
 			uget::net_monitor & monitor__
 		):
 			__host{host__},
 			__port{port__},
-			__uri{uri__},
-
-			__resolver{executor__},
-
-			__tls_rng{
-				std::make_shared<Botan::AutoSeeded_RNG>()
-			},
-			__tls_credentials{
-				std::make_shared<uget::credentials_manager>()
-			},
-			__tls_session{
-				std::make_shared<Botan::TLS::Session_Manager_In_Memory>(__tls_rng)
-			},
-			__tls_policy{
-				std::make_shared<Botan::TLS::Policy>()
-			},
-			__tls_server_info{},
-
-			__tls_context{
-				std::make_shared<Botan::TLS::Context>(
-					__tls_credentials,
-					__tls_rng,
-					__tls_session,
-					__tls_policy,
-					__tls_server_info
-				)
-			},
-
-			__tls_stream{
-				std::make_shared<Botan::TLS::Stream<boost::beast::tcp_stream>>(
-					__tls_context,
-					executor__
-				)
-			},
+			__depth{std::max<std::size_t>(depth__, 1)},
+			__decode{true},
+			__secure{true},
+			__pending(targets__.begin(), targets__.end()),
+			__sinks{std::move(sinks__)},
+			__abandoned{},
 
+			__executor{executor__},
+			__pool{pool__},
 			__monitor{monitor__}
 		{
-			__monitor.attach(0, * this);
+		}
+	public:
+		void decode(bool decode__)
+		{
+			__decode = decode__;
+		}
+		// false: plain http
+		void secure(bool secure__)
+		{
+			__secure = secure__;
+		}
+		bool abandoned(std::string_view target__) const
+		{
+			return std::ranges::find(__abandoned, target__) != __abandoned.end();
 		}
 	public:
 		boost::asio::awaitable<void> run()
 		{
-			auto result_body = co_await this->run_it();
-			if (result_body.size() == 0)
-			{
-				std::clog << "got nothing" << std::endl;
-			}
+			if (__secure)
+				co_await this->run<uget::tls_client>();
 			else
-			{
-				std::clog << "got: " << std::flush;
-				std::cout  << result_body << std::endl;
-			}
-			co_await this->shutdown();
+				co_await this->run<uget::http_client>();
 		}
-	public:
-		boost::asio::awaitable<std::string> run_it()
+	private:
+		template<class Client>
+		boost::asio::awaitable<void> run()
 		{
-			auto results = co_await this->resolve();
-
-			bool status = co_await this->connect(results, 0);
-			if (! status)
-				co_return "";
-
-			status = co_await this->handshake(0);
-			if (! status)
-				co_return "";
-
-			__request.set(boost::beast::http::field::host, __host);
-			__request.method(boost::beast::http::verb::get);
-			__request.version(11);
-			__request.target(__uri);
-			__request.set(boost::beast::http::field::content_type, "text/html");
-			status = co_await this->write(0);
-			if (! status)
-				co_return "";
-
-			co_return co_await this->read(0);
+			const int max_attempts = uget::policy_registry::shared().find(__host).max_attempts;
+			int failures = 0;
+			while (! __pending.empty())
+			{
+				auto before = __pending.size();
+				co_await this->drain<Client>();
+				// a connection that got nothing done counts against the retry policy
+				failures = __pending.size() < before ? 0 : failures + 1;
+				if (failures >= max_attempts)
+					throw std::runtime_error{"pipeline: no progress after "s + std::to_string(failures) + " connections"};
+			}
+			if (! __abandoned.empty())
+				throw std::runtime_error{
+					"pipeline: "s + std::to_string(__abandoned.size()) + " responses cut short, first "
+						+ __abandoned.front()
+				};
 		}
-	public:
-		boost::asio::awaitable<boost::asio::ip::tcp::resolver::results_type> resolve()
+		template<class Client>
+		std::shared_ptr<Client> client(const std::string & target__)
 		{
-			auto [ec, results] = co_await __resolver.async_resolve(
+			auto client = std::make_shared<Client>(
 				__host,
 				__port,
-				boost::asio::as_tuple(
-					boost::asio::use_awaitable
-				)
+				target__,
+				__executor,
+				__pool,
+				__monitor
 			);
-			if (ec)
-				throw std::system_error{ec, "async resolve error"};
-			std::clog << "async resolve ok" << std::endl;
-			co_return results;
+			client->decode(__decode);
+			return client;
 		}
-	public:
-		boost::asio::awaitable<bool> connect(auto results__, int times__)
+		// one connection's worth of work
+		template<class Client>
+		boost::asio::awaitable<void> drain()
 		{
-			__tls_stream->next_layer().expires_after(std::chrono::seconds(2));
-			auto [ec, ep] = co_await __tls_stream->next_layer().async_connect(
-				results__,
-				boost::asio::as_tuple(boost::asio::use_awaitable)
-			);
-			++times__;
-			if (! ec)
+			typename Client::connection_ptr connection;
+			std::deque<std::shared_ptr<Client>> in_flight;
+			bool reusable = false;
+			try
 			{
-				std::clog << "connected after trying " << times__ << " times" << std::endl;
-				co_return true;
+				auto opener = this->client<Client>(__pending.front());
+				connection = co_await opener->open();
+				co_await this->fill<Client>(connection, in_flight);
+				while (! in_flight.empty())
+				{
+					auto & client = in_flight.front();
+					auto target = std::string{client->request().target()};
+					co_await client->read(__sinks(target));
+					__monitor.record_bytes(client->body_bytes());
+					std::clog << "pipeline: " << client->status() << ' '
+						<< client->body_bytes() << " bytes " << target << std::endl;
+
+					reusable = client->keep_alive();
+					in_flight.pop_front();
+					if (! reusable)
+						break;
+					co_await this->fill<Client>(connection, in_flight);
+				}
 			}
-			else if (times__ > 10)
+			catch (const std::system_error & e)
 			{
-				throw std::system_error{ec, "async connect error (have tried "s
-				+  std::to_string(times__) + " times)"};
-				co_return false;
+				std::clog << "pipeline: connection failed: " << e.what() << std::endl;
+				reusable = false;
+				// a half read body is already in its sink, it can not be sent again
+				if (! in_flight.empty() && in_flight.front()->body_bytes() != 0)
+				{
+					std::clog << "pipeline: giving up on " << in_flight.front()->request().target() << std::endl;
+					__monitor.record_failure();
+					__abandoned.emplace_back(in_flight.front()->request().target());
+					in_flight.pop_front();
+				}
 			}
-			else
+
+			if (! in_flight.empty())
 			{
-				std::clog << "Connection retrying ... " << times__ << std::endl;
-				co_return co_await this->connect(results__, times__);
+				std::clog << "pipeline: server closed with " << in_flight.size()
+					<< " requests unanswered, pipelining turned off" << std::endl;
+				__depth = 1;
+				for (auto it = in_flight.rbegin(); it != in_flight.rend(); ++it)
+					__pending.emplace_front((* it)->request().target());
 			}
-			co_return false;
+
+			if (! connection)
+				co_return;
+			if (reusable && in_flight.empty())
+				__pool.release(__host, __port, std::move(connection));
+			else
+				connection->close();
 		}
-	public:
-		boost::asio::awaitable<bool> handshake(int times__)
+		template<class Client>
+		boost::asio::awaitable<void> fill(
+			typename Client::connection_ptr & connection__,
+			std::deque<std::shared_ptr<Client>> & in_flight__
+		)
 		{
-			__tls_stream->next_layer().expires_after(std::chrono::seconds(2));
-			auto [ec] = co_await __tls_stream->async_handshake(
-				Botan::TLS::Connection_Side::Client,
-				boost::asio::as_tuple(boost::asio::use_awaitable)
-			);
-			++times__;
-			if (! ec)
+			while (in_flight__.size() < __depth && ! __pending.empty())
 			{
-				this->signal("async handshaked after trying "s + std::to_string(times__) + " times");
-				co_return true;
+				auto client = this->client<Client>(__pending.front());
+				client->use(connection__);
+				// queued before the write, so a failed write is sent again later
+				in_flight__.push_back(client);
+				__pending.pop_front();
+				co_await client->write();
 			}
-			else if (times__ > 10)
+		}
+	};
+
+	// The client half of the benchmark, usually pointed at uget-bench-server:
+	// the same number of GETs at every concurrency level, one table row each.
+	// Given shard counts, every level runs once per count on an engine, the
+	// workers and requests split between the shards, and the speedup column
+	// against the first count is the scaling curve.
+	// A burst opens that many new connections at once after the warmup,
+	// one request each and outside the table, so the table shows what
+	// their handshakes do to the transfers already running.
+	class load_test
+	{
+	private:
+		struct level
+		{
+			std::size_t concurrency = 0;
+			std::size_t requests = 0;
+			std::size_t issued = 0;
+			std::size_t handshakes = 0;
+			std::size_t failures = 0;
+			std::uint64_t bytes = 0;
+			std::vector<double> latencies;	// ms
+			double seconds = 0;
+			// operator new calls after the first warmup requests; with a
+			// burst, only from when its last request is over
+			std::size_t warmup = 0;
+			std::uint64_t allocations = 0;
+		public:
+			// the shards' levels as one, over the slowest shard's time
+			void merge(level && other__)
 			{
-				throw std::system_error{ec,
-					"handshake error after trying "s + std::to_string(times__) + " times"
-				};
-				co_return false;
+				concurrency += other__.concurrency;
+				requests += other__.requests;
+				issued += other__.issued;
+				handshakes += other__.handshakes;
+				failures += other__.failures;
+				bytes += other__.bytes;
+				latencies.insert(latencies.end(), other__.latencies.begin(), other__.latencies.end());
+				seconds = std::max(seconds, other__.seconds);
+				warmup += other__.warmup;
+				allocations += other__.allocations;
 			}
-			else
+		};
+	private:
+		const uget::url __url;
+		const std::size_t __requests;
+		const bool __fresh;
+		uget::net_monitor & __monitor;
+	private:
+		std::size_t __burst;
+	public:
+		load_test(
+			const uget::url & url__,
+			std::size_t requests__,
+			bool fresh__,
+			uget::net_monitor & monitor__
+		):
+			__url{url__},
+			__requests{requests__},
+			__fresh{fresh__},
+			__monitor{monitor__},
+
+			__burst{0}
+		{
+			uget::trace::shared().enable(false);
+		}
+	public:
+		void burst(std::size_t connections__)
+		{
+			__burst = connections__;
+		}
+	public:
+		boost::asio::awaitable<void> run(const std::vector<std::size_t> & levels__)
+		{
+			this->header(false);
+			for (auto concurrency: levels__)
 			{
-				std::clog << "Handshake retrying ... " << times__ << std::endl;
-				co_return co_await this->handshake(times__);
+				level stats;
+				co_await this->measure(stats, std::max<std::size_t>(concurrency, 1), __requests);
+				this->report(stats, 0, 0);
 			}
-			co_return false;
 		}
-	public:
-		boost::asio::awaitable<bool> write(int times__)
+		// blocks until every level has run on every shard count
+		void run(const std::vector<std::size_t> & shards__, const std::vector<std::size_t> & levels__)
 		{
-			__tls_stream->next_layer().expires_after(std::chrono::seconds(2));
-			auto [ec, bytes] = co_await boost::beast::http::async_write(
-				* __tls_stream,
-				__request,
-				boost::asio::as_tuple(boost::asio::use_awaitable)
-			);
-			++times__;
-			if (! ec)
+			this->header(true);
+			for (auto concurrency: levels__)
 			{
-				std::clog << "Request ok after trying " << times__ << " times\n";
-				co_return true;
+				double base = 0;
+				for (auto count: shards__)
+				{
+					uget::engine engine{count};
+					auto shards = engine.size();
+					// at least one worker per shard
+					auto workers = std::max(concurrency, shards);
+					std::vector<level> stats(shards);
+					engine.start(
+						[this, &stats, workers, shards] (uget::engine::shard & shard__) -> boost::asio::awaitable<void>
+						{
+							auto i = shard__.index();
+							co_await this->measure(stats[i], share(workers, shards, i), share(__requests, shards, i));
+						}
+					);
+					engine.join();
+
+					level all;
+					for (auto & one: stats)
+						all.merge(std::move(one));
+					double rate = all.seconds > 0 ? all.latencies.size() / all.seconds : 0;
+					if (base == 0)
+						base = rate;
+					this->report(all, shards, base > 0 ? rate / base : 0);
+				}
 			}
-			else if (times__ > 10)
+		}
+	private:
+		// concurrency__ workers share requests__ on the calling coroutine's executor
+		boost::asio::awaitable<void> measure(level & stats__, std::size_t concurrency__, std::size_t requests__)
+		{
+			stats__.concurrency = concurrency__;
+			stats__.requests = requests__;
+			stats__.latencies.reserve(requests__);
+			// every worker's first requests fill the pools
+			stats__.warmup = std::min(requests__, 4 * concurrency__ + requests__ / 10);
+			// a cold pool per level; size 0 closes every connection after one request
+			uget::connection_pool pool{std::chrono::seconds(30), __fresh ? 0 : concurrency__};
+
+			auto executor = co_await boost::asio::this_coro::executor;
+			std::size_t running = 0;
+			std::size_t measured = concurrency__;
+			boost::asio::steady_timer done{executor, boost::asio::steady_timer::time_point::max()};
+			// the burst waits for this, and skips once the measured workers are done
+			bool warm = false;
+			boost::asio::steady_timer warmed{executor, boost::asio::steady_timer::time_point::max()};
+			auto begin = std::chrono::steady_clock::now();
+			for (std::size_t i = 0; i < concurrency__; ++i)
 			{
-				throw std::system_error{
-					ec,
-					"async write error after trying "s + std::to_string(times__) + " times"
-				};
-				co_return false;
+				++running;
+				boost::asio::co_spawn(
+					executor,
+					[this, &stats__, &pool, &running, &done, &measured, &warm, &warmed, begin] -> boost::asio::awaitable<void>
+					{
+						if (__url.secure)
+							co_await this->work<uget::tls_client>(stats__, pool, warm, warmed);
+						else
+							co_await this->work<uget::http_client>(stats__, pool, warm, warmed);
+						std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+						stats__.seconds = elapsed.count();
+						if (--measured == 0)
+						{
+							warm = true;
+							warmed.cancel();
+						}
+						if (--running == 0)
+							done.cancel();
+					},
+					boost::asio::detached
+				);
 			}
-			else
+			uget::connection_pool burst_pool{std::chrono::seconds(30), 0};
+			std::size_t bursting = __burst;
+			for (std::size_t i = 0; i < __burst; ++i)
 			{
-				std::clog << "Request retrying ..." << times__ << std::endl;
-				co_return co_await this->write(times__);
+				++running;
+				boost::asio::co_spawn(
+					executor,
+					[this, &stats__, &burst_pool, &running, &done, &measured, &warm, &warmed, &bursting] -> boost::asio::awaitable<void>
+					{
+						if (! warm)
+							co_await warmed.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+						if (measured != 0)
+						{
+							if (__url.secure)
+								co_await this->once<uget::tls_client>(burst_pool);
+							else
+								co_await this->once<uget::http_client>(burst_pool);
+						}
+						// the burst's handshakes are not the steady state, count from here
+						if (--bursting == 0)
+						{
+							stats__.warmup = stats__.issued;
+							stats__.allocations = uget::allocations;
+						}
+						if (--running == 0)
+							done.cancel();
+					},
+					boost::asio::detached
+				);
 			}
-			co_return false;
+			co_await done.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+			if (stats__.warmup < requests__)
+				stats__.allocations = uget::allocations - stats__.allocations;
+			co_await pool.shutdown();
 		}
-	public:
-		boost::asio::awaitable<std::string> read(int times__)
+		// one client per worker, run again for every request
+		template<class Client>
+		boost::asio::awaitable<void> work(
+			level & stats__,
+			uget::connection_pool & pool__,
+			bool & warm__,
+			boost::asio::steady_timer & warmed__
+		)
 		{
-			__tls_stream->next_layer().expires_after(std::chrono::seconds(2));
-			auto [ec, bytes] = co_await boost::beast::http::async_read(
-				* __tls_stream,
-				__buffer,
-				__response,
-				boost::asio::as_tuple(boost::asio::use_awaitable)
-			);
-			++times__;
-			if (! ec)
+			uget::null_sink sink;
+			std::shared_ptr<Client> client;
+			while (stats__.issued < stats__.requests)
 			{
-				std::clog << "Async read ok ater trying " << times__ << " times\n";
-				this->signal("Read OK: http body is got successfully.");
-				co_return __response.body();
+				if (stats__.issued++ == stats__.warmup)
+				{
+					stats__.allocations = uget::allocations;
+					warm__ = true;
+					warmed__.cancel();
+				}
+				auto begin = std::chrono::steady_clock::now();
+				try
+				{
+					if (! client)
+					{
+						client = std::make_shared<Client>(
+							__url.host,
+							__url.port,
+							__url.target,
+							co_await boost::asio::this_coro::executor,
+							pool__,
+							__monitor
+						);
+						client->decode(false);
+						client->cache(false);
+						client->quiet();
+					}
+					stats__.bytes += co_await client->run_it(sink);
+					co_await client->finish();
+					if (! client->reused())
+						++stats__.handshakes;
+				}
+				catch (const std::exception &)
+				{
+					++stats__.failures;
+					client.reset();
+					continue;
+				}
+				std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - begin;
+				stats__.latencies.push_back(ms.count());
 			}
-			else if (times__ > 10)
+		}
+		// one request on a new connection, for the burst; failures are not counted
+		template<class Client>
+		boost::asio::awaitable<void> once(uget::connection_pool & pool__)
+		{
+			uget::null_sink sink;
+			try
 			{
-				throw std::system_error{
-					ec,
-					"async read error after trying "s + std::to_string(times__) + " times"
-				};
-				co_return "";
+				auto client = std::make_shared<Client>(
+					__url.host,
+					__url.port,
+					__url.target,
+					co_await boost::asio::this_coro::executor,
+					pool__,
+					__monitor
+				);
+				client->decode(false);
+				client->cache(false);
+				client->quiet();
+				co_await client->run_it(sink);
+				co_await client->finish();
 			}
-			else
+			catch (const std::exception &)
 			{
-				std::clog << "Read retrying ... " << times__ << std::endl;
-				co_return co_await this->read(times__);
 			}
-			co_return "";
 		}
-	public:
-		boost::asio::awaitable<void> shutdown()
+		// the part of total__ that shard index__ of shards__ takes
+		static std::size_t share(std::size_t total__, std::size_t shards__, std::size_t index__)
 		{
-			auto [ec] = co_await __tls_stream->async_shutdown(
-				boost::asio::as_tuple(boost::asio::use_awaitable)
-			);
-			std::clog << "closed: " << ec << std::endl;
-			this->signal("async shutdown OK. "s + ec.message());
+			return total__ / shards__ + (index__ < total__ % shards__ ? 1 : 0);
 		}
-	public:
-		uget::net_monitor::connection_type connect(
-			int prior__,
-			const uget::net_monitor::slot_type & slot__
-		)
+		void header(bool shards__) const
 		{
-			return __signal.connect(prior__, slot__);
+			std::cout << __url.str() << ", " << __requests << " requests per level, "
+				<< (__fresh ? "new connection per request" : "keep-alive");
+			if (__burst != 0)
+				std::cout << ", a burst of " << __burst << " new connections after warmup";
+			std::cout << '\n';
+			if (shards__)
+				std::cout << std::setw(7) << "shards";
+			std::cout << std::setw(6) << "conc" << std::setw(10) << "req/s";
+			if (shards__)
+				std::cout << std::setw(9) << "speedup";
+			std::cout << std::setw(10) << "hs/s" << std::setw(10) << "MB/s" << std::setw(10) << "p50 ms"
+				<< std::setw(10) << "p99 ms" << std::setw(10) << "p999 ms" << std::setw(8) << "errors"
+				<< std::setw(10) << "alloc/req" << std::endl;
 		}
-		void signal(const std::string msg__)
+		// shards__ 0 leaves out the shards and speedup columns
+		void report(level & stats__, std::size_t shards__, double speedup__)
 		{
-			this->__signal(msg__);
+			auto & latencies = stats__.latencies;
+			std::ranges::sort(latencies);
+			auto percentile = [&latencies] (double p)
+			{
+				if (latencies.empty())
+					return 0.0;
+				auto rank = static_cast<std::size_t>(std::ceil(p * latencies.size()));
+				return latencies[std::clamp<std::size_t>(rank, 1, latencies.size()) - 1];
+			};
+			auto seconds = stats__.seconds;
+			std::cout << std::fixed << std::setprecision(1);
+			if (shards__ != 0)
+				std::cout << std::setw(7) << shards__;
+			std::cout << std::setw(6) << stats__.concurrency
+				<< std::setw(10) << latencies.size() / seconds;
+			if (shards__ != 0)
+				std::cout << std::setw(8) << std::setprecision(2) << speedup__ << 'x' << std::setprecision(1);
+			std::cout << std::setw(10) << stats__.handshakes / seconds
+				<< std::setw(10) << stats__.bytes / seconds / (1024 * 1024)
+				<< std::setw(10) << percentile(0.50)
+				<< std::setw(10) << percentile(0.99)
+				<< std::setw(10) << percentile(0.999)
+				<< std::setw(8) << stats__.failures;
+			if (stats__.warmup < stats__.requests)
+				std::cout << std::setw(10) << static_cast<double>(stats__.allocations) / (stats__.requests - stats__.warmup);
+			std::cout << std::endl;
 		}
 	};
-
-	void uget::net_monitor::attach(
-		int prior__,
-		uget::tls_client & client__
-	)
-	{
-		client__.connect(
-			prior__,
-			std::bind(
-				&uget::net_monitor::queue_message,
-				this,
-				_1
-			)
-		);
-	}
 }	// namespace uget
 
+// Counts into uget::allocations and otherwise does what the default does.
+// The array and nothrow forms end up here as well.
+void * operator new(std::size_t size__)
+{
+	++uget::allocations;
+	if (auto p = std::malloc(size__ == 0 ? 1 : size__))
+		return p;
+	throw std::bad_alloc{};
+}
+void * operator new(std::size_t size__, std::align_val_t align__)
+{
+	++uget::allocations;
+	auto align = static_cast<std::size_t>(align__);
+	if (auto p = std::aligned_alloc(align, (std::max<std::size_t>(size__, 1) + align - 1) / align * align))
+		return p;
+	throw std::bad_alloc{};
+}
+void operator delete(void * p__) noexcept
+{
+	std::free(p__);
+}
+void operator delete(void * p__, std::size_t) noexcept
+{
+	std::free(p__);
+}
+void operator delete(void * p__, std::align_val_t) noexcept
+{
+	std::free(p__);
+}
+void operator delete(void * p__, std::size_t, std::align_val_t) noexcept
+{
+	std::free(p__);
+}
+
 int main(int argc, char * argv[])
 try
 {
-	std::string host;
-	std::string port;
-	std::string uri;
+	bool help = false;
+	std::string input;
+	std::size_t jobs = 16;
+	std::size_t per_host = 6;
+	std::size_t shards = 1;
+	std::string output_dir;
+	std::string output;
+	std::size_t crawl = 0;
+	std::size_t crawl_limit = 100000;
+	std::size_t crawl_frontier = 10000;
+	std::size_t segments = 1;
+	std::string session_db = (uget::cache_dir() / "tls-sessions.db").string();
+	bool no_session_db = false;
+	int dns_ttl = 60;
+	std::string policy;
+	std::vector<std::string> host_policies;
+	std::string tls_policy = "default";
+	std::size_t handshake_threads = 0;
+	std::string limit;
+	std::vector<std::string> host_limits;
+	bool no_compressed = false;
+	std::vector<std::string> ca_files;
+	std::string bench;
+	std::size_t bench_requests = 1000;
+	std::string bench_levels = "1,4,16,64";
+	bool bench_fresh = false;
+	std::string bench_shards;
+	std::size_t bench_burst = 0;
+	std::string metrics;
+	std::string metrics_format = "json";
+	std::size_t pipeline = 1;
+	bool plain = false;
+	bool cache = false;
+	std::string cache_dir = (uget::cache_dir() / "http").string();
+	std::string hash;
+	std::string manifest;
+	std::string expect_sha256;
+	std::vector<std::string> mirrors;
+	std::string record;
+	std::string replay;
+	double replay_scale = 1;
+	std::vector<std::string> args;
 
-	if (argc == 4)
-	{
-		host = argv[1];
-		port = argv[2];
-		uri = argv[3];
-	}
-	else
+	auto cli = lyra::help(help)
+		| lyra::opt(input, "file")["-i"]["--input"]("batch mode: read urls from file, one per line (- for stdin)")
+		| lyra::opt(jobs, "n")["-j"]["--jobs"]("batch mode: max requests in flight (default 16)")
+		| lyra::opt(per_host, "n")["--per-host"]("batch mode: max requests in flight per host (default 6)")
+		| lyra::opt(shards, "n")["--shards"]("batch mode: spread hosts over n threads, each with its own connections (0: one per core, default 1)")
+		| lyra::opt(output_dir, "dir")["-O"]["--output-dir"]("batch mode: save bodies into dir")
+		| lyra::opt(crawl, "depth")["--crawl"]("batch mode: follow links in html pages, up to depth steps below the urls")
+		| lyra::opt(crawl_limit, "n")["--crawl-limit"]("with --crawl: take in at most n urls (default 100000)")
+		| lyra::opt(crawl_frontier, "n")["--crawl-frontier"]("with --crawl: pending urls kept per host (default 10000)")
+		| lyra::opt(output, "file")["-o"]["--output"]("single host mode: stream the body into file instead of stdout")
+		| lyra::opt(mirrors, "url")["--mirror"]("mirror mode: one object from these urls, hedged by their p95 first byte time; repeatable, takes -o")
+		| lyra::opt(segments, "n")["-s"]["--segments"]("with -o: download n byte ranges in parallel, resumable")
+		| lyra::opt(plain)["--plain"]("single host mode: plain http, no tls (e.g. internal mirrors)")
+		| lyra::opt(pipeline, "n")["--pipeline"]("single host mode: keep up to n requests in flight on one connection")
+		| lyra::opt(session_db, "file")["--session-db"]("tls session cache kept across runs (default: "s + session_db + ")")
+		| lyra::opt(no_session_db)["--no-session-db"]("keep tls sessions in memory only")
+		| lyra::opt(dns_ttl, "seconds")["--dns-ttl"]("how long resolved addresses are reused (default 60, 0 disables)")
+		| lyra::opt(policy, "key=value,...")["--policy"](
+			"retry policy: deadline (until the response header, 0: none), connect-timeout, handshake-timeout, "
+			"write-timeout, read-timeout (idle, per body chunk), backoff, backoff-max (seconds), retries, jitter (0..1)")
+		| lyra::opt(host_policies, "host:key=value,...")["--host-policy"]("retry policy for one host, repeatable")
+		| lyra::opt(cache)["--cache"]("keep responses on disk and revalidate them instead of fetching again")
+		| lyra::opt(cache_dir, "dir")["--cache-dir"]("where --cache keeps responses (default: "s + cache_dir + ")")
+		| lyra::opt(limit, "key=value,...")["--limit"](
+			"bandwidth and request rate caps, per second: rate, requests (all transfers), "
+			"host-rate, host-requests (each host); rates take k, M or G")
+		| lyra::opt(host_limits, "host:key=value,...")["--host-limit"]("rate and requests for one host, repeatable")
+		| lyra::opt(hash, "list")["--hash"]("digests to take as bodies stream in: sha256, sha512, blake2b, ...")
+		| lyra::opt(manifest, "file")["--manifest"]("append \"SHA256 (file) = hex\" lines for every body, as sha256sum -c reads them")
+		| lyra::opt(expect_sha256, "hex")["--expect-sha256"]("single host and mirror mode: fail unless the body has this sha256 (batch: after the urls)")
+		| lyra::opt(no_compressed)["--no-compressed"]("do not ask for gzip/deflate/br, keep the body as sent")
+		| lyra::opt(tls_policy, "default|tuned|tls13")["--tls-policy"](
+			"tuned: cipher order by cpu, tls 1.3 first, tickets reused; tls13: tuned without tls 1.2")
+		| lyra::opt(handshake_threads, "n")["--handshake-threads"]("do tls handshake crypto on n threads of its own, so new connections do not stall running transfers (default 0: inline)")
+		| lyra::opt(ca_files, "pem")["--ca-file"]("also trust the certificates in this PEM file, repeatable")
+		| lyra::opt(bench, "url")["--bench"]("load test url, e.g. https://localhost:8443/bytes/65536 (see uget-bench-server)")
+		| lyra::opt(bench_requests, "n")["--bench-requests"]("requests per concurrency level (default 1000)")
+		| lyra::opt(bench_levels, "list")["--bench-concurrency"]("concurrency levels (default 1,4,16,64)")
+		| lyra::opt(bench_fresh)["--bench-fresh"]("new connection and handshake for every request")
+		| lyra::opt(bench_burst, "n")["--bench-burst"]("open n new connections at once after each level's warmup, outside the table")
+		| lyra::opt(bench_shards, "list")["--bench-shards"]("run every level on these shard counts, e.g. 1,2,4,8 (0: one per core)")
+		| lyra::opt(metrics, "file")["--metrics"]("write per-phase timings here at exit and on SIGUSR1 (- for stderr)")
+		| lyra::opt(metrics_format, "json|prometheus")["--metrics-format"]("format of --metrics (default json)")
+		| lyra::opt(record, "file")["--record"]("append every response, with its timing, to this archive")
+		| lyra::opt(replay, "file")["--replay"]("answer every request from this archive, served in process on loopback")
+		| lyra::opt(replay_scale, "x")["--replay-scale"]("with --replay: recorded latencies times x (default 1, 0 for none)")
+		| lyra::arg(args, "host port uri...")("single host mode: <host> <port> <uri> [<uri> ...]")
+	;
+	auto parsed = cli.parse({argc, argv});
+	if (help || ! parsed || (input.empty() && bench.empty() && mirrors.empty() && args.size() < 3))
 	{
-		std::string line3 = ""s + program_name + " <host> <port> <uri>";
-		std::string line4 = ""s + "For example: " + program_name + " example.com 443 /cpp";
+		std::string line3 = ""s + program_name + " <host> <port> <uri> [<uri> ...]";
+		std::string line4 = ""s + "For example: " + program_name + " example.com 443 /cpp /cpp/news";
+		std::string line5 = ""s + program_name + " -i urls.txt -j 64 --per-host 8 [--crawl 3 -O mirror]";
+		std::string line6 = ""s + program_name + " --mirror https://a.example.com/x.tar --mirror http://b.example.com/x.tar -o x.tar";
 		std::clog
 			<< "\n\n" << "command options:\n"
-			<< line3 << '\n' << line4 << "\n\n";
-		throw std::runtime_error{"arguments error"};
+			<< line3 << '\n' << line4 << '\n' << line5 << '\n' << line6 << "\n\n"
+			<< cli << "\n\n";
+		if (help)
+			return 0;
+		throw std::runtime_error{"arguments error"s + (parsed ? ""s : ": "s + parsed.message())};
+	}
+
+	if (! no_session_db)
+		uget::session_cache::open(session_db);
+	uget::dns_cache::shared().ttl(std::chrono::seconds(dns_ttl));
+	uget::policy_registry::shared().fallback().apply(policy);
+	for (const auto & spec: host_policies)
+		uget::policy_registry::shared().apply_host(spec);
+	uget::rate_limits::shared().apply(limit);
+	for (const auto & spec: host_limits)
+		uget::rate_limits::shared().apply_host(spec);
+	for (const auto & pem: ca_files)
+		uget::credentials_manager::trust(pem);
+	uget::tls_policy::select(tls_policy);
+	if (handshake_threads != 0)
+		uget::crypto_pool::shared().start(handshake_threads);
+	if (cache)
+		uget::http_cache::shared().open(cache_dir);
+	auto & integrity = uget::integrity::shared();
+	integrity.algorithms(hash);
+	if (! manifest.empty())
+	{
+		integrity.manifest(manifest);
+		if (integrity.algorithms().empty())
+			integrity.require("SHA-256");
+	}
+	if (! expect_sha256.empty())
+		integrity.require("SHA-256");
+	if (! record.empty())
+		uget::archive::shared().open(record);
+	std::optional<uget::replay_server> replay_server;
+	if (! replay.empty())
+	{
+		replay_server.emplace(replay, replay_scale);
+		replay_server->start();
 	}
 
 	uget::net_monitor monitor;
+	uget::connection_pool pool;
 
 	boost::asio::io_context io_context;
+
+	if (metrics_format != "json" && metrics_format != "prometheus")
+		throw std::runtime_error{"--metrics-format is json or prometheus"};
+	monitor.metrics(metrics, metrics_format == "prometheus");
+	monitor.listen(io_context.get_executor());
+	// every mode ends with this, so the SIGUSR1 wait does not keep io_context running
+	auto done = [&monitor] (std::exception_ptr)
+	{
+		monitor.stop();
+	};
+
+	if (! bench.empty())
+	{
+		auto url = uget::url::parse(bench);
+		if (! url)
+			throw std::runtime_error{"--bench needs an http:// or https:// url"};
+		auto numbers = [] (std::string_view list__)
+		{
+			std::vector<std::size_t> result;
+			while (! list__.empty())
+			{
+				auto comma = list__.find(',');
+				std::size_t number = 0;
+				auto item = list__.substr(0, comma);
+				std::from_chars(item.data(), item.data() + item.size(), number);
+				result.push_back(number);
+				list__ = comma == std::string_view::npos ? "" : list__.substr(comma + 1);
+			}
+			return result;
+		};
+		uget::load_test test{* url, bench_requests, bench_fresh, monitor};
+		test.burst(bench_burst);
+		if (bench_shards.empty())
+		{
+			boost::asio::co_spawn(io_context, test.run(numbers(bench_levels)), done);
+			io_context.run();
+		}
+		else
+		{
+			// the shards run on threads of their own until every level is done
+			test.run(numbers(bench_shards), numbers(bench_levels));
+		}
+		monitor.dump();
+		return 0;
+	}
+
+	if (! input.empty() && shards != 1)
+	{
+		if (crawl != 0)
+			throw std::runtime_error{"--crawl runs on one shard, leave out --shards"};
+		// parsed up front: a sha256 on any line turns hashing on before a shard looks
+		std::vector<uget::batch::entry> entries;
+		{
+			std::ifstream file;
+			if (input != "-")
+			{
+				file.open(input);
+				if (! file)
+					throw std::runtime_error{"can not open " + input};
+			}
+			std::istream & in = input == "-" ? std::cin : file;
+			for (std::string line; std::getline(in, line);)
+			{
+				if (auto entry = uget::batch::parse(line))
+					entries.push_back(std::move(* entry));
+			}
+		}
+		if (! output_dir.empty())
+			std::filesystem::create_directories(output_dir);
+
+		uget::engine engine{shards};
+		// -j is the total in flight, split exactly: every shard runs at least one
+		if (jobs < engine.size())
+			throw std::runtime_error{
+				"--jobs "s + std::to_string(jobs) + " is less than the " + std::to_string(engine.size()) + " shards"
+			};
+		std::vector<std::unique_ptr<uget::batch>> batches;
+		for (std::size_t i = 0; i < engine.size(); ++i)
+		{
+			batches.push_back(std::make_unique<uget::batch>(
+				engine.at(i).executor(),
+				jobs / engine.size() + (i < jobs % engine.size() ? 1 : 0),
+				per_host,
+				output_dir,
+				engine.at(i).pool(),
+				monitor
+			));
+			batches.back()->decode(! no_compressed);
+			batches.back()->hold();
+		}
+		std::clog << "batch: " << entries.size() << " urls, " << jobs << " jobs, "
+			<< per_host << " per host, " << engine.size() << " shards" << std::endl;
+
+		engine.start(
+			[&batches] (uget::engine::shard & shard__) -> boost::asio::awaitable<void>
+			{
+				co_await batches[shard__.index()]->run();
+				co_await shard__.pool().shutdown();
+			},
+			[&io_context, &done]
+			{
+				boost::asio::post(io_context, [&done] { done(nullptr); });
+			}
+		);
+		for (auto & entry: entries)
+		{
+			const auto & url = entry.mirrors.front();
+			engine.submit(
+				url.host,
+				url.port,
+				[&batches, entry = std::move(entry)] (uget::engine::shard & shard__)
+				{
+					batches[shard__.index()]->add(entry);
+				}
+			);
+		}
+		for (std::size_t i = 0; i < engine.size(); ++i)
+			boost::asio::post(engine.at(i).executor(), [batch = batches[i].get()] { batch->close(); });
+
+		// serves SIGUSR1 until the last shard is done
+		io_context.run();
+		engine.join();
+		monitor.dump();
+		return std::ranges::all_of(batches, [] (const auto & batch) { return batch->verified(); }) ? 0 : 1;
+	}
+
+	if (! input.empty())
+	{
+		uget::batch batch{
+			io_context.get_executor(),
+			jobs,
+			per_host,
+			output_dir,
+			pool,
+			monitor
+		};
+		batch.decode(! no_compressed);
+		if (crawl != 0)
+			batch.crawl(crawl, crawl_limit, crawl_frontier);
+		std::size_t count = 0;
+		if (input == "-")
+		{
+			count = batch.add(std::cin);
+		}
+		else
+		{
+			std::ifstream in{input};
+			if (! in)
+				throw std::runtime_error{"can not open " + input};
+			count = batch.add(in);
+		}
+		if (! output_dir.empty())
+			std::filesystem::create_directories(output_dir);
+		std::clog << "batch: " << count << " urls, " << jobs << " jobs, "
+			<< per_host << " per host" << std::endl;
+
+		boost::asio::co_spawn(
+			io_context,
+			[&batch, &pool] -> boost::asio::awaitable<void>
+			{
+				co_await batch.run();
+				co_await pool.shutdown();
+			},
+			done
+		);
+		io_context.run();
+		monitor.dump();
+		return batch.verified() ? 0 : 1;
+	}
+
+	if (! mirrors.empty())
+	{
+		std::vector<uget::url> urls;
+		for (const auto & text: mirrors)
+		{
+			auto url = uget::url::parse(text);
+			if (! url)
+				throw std::runtime_error{"--mirror needs an http:// or https:// url"};
+			urls.push_back(* url);
+		}
+		std::unique_ptr<uget::body_sink> sink;
+		if (output.empty())
+			sink = std::make_unique<uget::ostream_sink>(std::cout);
+		else
+			sink = uget::make_file_sink(io_context.get_executor(), output);
+		std::unique_ptr<uget::hash_sink> hashes;
+		if (! integrity.algorithms().empty())
+			hashes = std::make_unique<uget::hash_sink>(* sink, integrity.algorithms());
+
+		bool failed = false;
+		boost::asio::co_spawn(
+			io_context,
+			[&] -> boost::asio::awaitable<void>
+			{
+				try
+				{
+					uget::hedged_fetch hedged{
+						co_await boost::asio::this_coro::executor,
+						urls,
+						hashes ? * hashes : * sink,
+						pool,
+						monitor
+					};
+					hedged.decode(! no_compressed);
+					auto bytes = co_await hedged.run();
+					std::clog << "got: " << bytes << " bytes from " << hedged.winner().str() << std::endl;
+					if (hashes)
+						failed = ! integrity.check(output.empty() ? urls.front().str() : output, hashes->digests(), "SHA-256", expect_sha256);
+				}
+				catch (const std::exception & e)
+				{
+					std::cerr << "\n\n\n";
+					std::cerr << "Caught std::exception network:\n" << e.what()
+						<< std::endl << std::endl;
+					failed = true;
+				}
+				co_await pool.shutdown();
+			},
+			done
+		);
+		io_context.run();
+		monitor.dump();
+		return failed ? 1 : 0;
+	}
+
+	const std::string host = args[0];
+	const std::string port = args[1];
+	const std::vector<std::string> uris(args.begin() + 2, args.end());
+
+	if (! output.empty() && uris.size() != 1)
+		throw std::runtime_error{"--output takes exactly one uri"};
+	if (segments > 1 && output.empty())
+		throw std::runtime_error{"--segments needs --output"};
+	if (! expect_sha256.empty() && uris.size() != 1)
+		throw std::runtime_error{"--expect-sha256 takes exactly one uri"};
+
+	if (segments > 1)
+	{
+		uget::segmented_download download{
+			io_context.get_executor(),
+			uget::url{host, port, uris.front(), ! plain},
+			output,
+			segments,
+			pool,
+			monitor
+		};
+		bool ranged = false;
+		bool failed = false;
+		boost::asio::co_spawn(
+			io_context,
+			[&download, &ranged, &failed, &pool] -> boost::asio::awaitable<void>
+			{
+				try
+				{
+					ranged = co_await download.run();
+				}
+				catch (const std::exception & e)
+				{
+					std::cerr << "\n\n\n";
+					std::cerr << "Caught std::exception network:\n" << e.what()
+						<< std::endl << std::endl;
+					failed = true;
+				}
+				co_await pool.shutdown();
+			},
+			done
+		);
+		io_context.run();
+		// the ranges landed out of order, so this one is read back from the file
+		if (ranged && ! failed && ! integrity.algorithms().empty())
+			failed = ! integrity.check(output, uget::hash_file(output, integrity.algorithms()), "SHA-256", expect_sha256);
+		if (failed || ranged)
+		{
+			monitor.dump();
+			return failed ? 1 : 0;
+		}
+		std::clog << "segmented: server does not support ranges, using one stream" << std::endl;
+		io_context.restart();
+		monitor.listen(io_context.get_executor());
+	}
+
+	std::unique_ptr<uget::body_sink> sink;
+	if (output.empty())
+		sink = std::make_unique<uget::ostream_sink>(std::cout);
+	else
+		sink = uget::make_file_sink(io_context.get_executor(), output);
+
+	if (pipeline > 1 && uris.size() > 1)
+	{
+		// a retried request gets a fresh hash_sink, the abandoned one is never closed
+		std::vector<std::pair<std::string, std::unique_ptr<uget::hash_sink>>> hashes;
+		uget::pipeline requests{
+			io_context.get_executor(),
+			host,
+			port,
+			uris,
+			pipeline,
+			[&sink, &hashes, &integrity] (const std::string & uri__) -> uget::body_sink &
+			{
+				if (integrity.algorithms().empty())
+					return * sink;
+				hashes.emplace_back(uri__, std::make_unique<uget::hash_sink>(* sink, integrity.algorithms()));
+				return * hashes.back().second;
+			},
+			pool,
+			monitor
+		};
+		requests.decode(! no_compressed);
+		requests.secure(! plain);
+		bool failed = false;
+		boost::asio::co_spawn(
+			io_context,
+			[&requests, &failed, &pool] -> boost::asio::awaitable<void>
+			{
+				try
+				{
+					co_await requests.run();
+				}
+				catch (const std::exception & e)
+				{
+					std::cerr << "\n\n\n";
+					std::cerr << "Caught std::exception network:\n" << e.what()
+						<< std::endl << std::endl;
+					failed = true;
+				}
+				co_await pool.shutdown();
+			},
+			done
+		);
+		io_context.run();
+		for (const auto & [uri, hashed]: hashes)
+		{
+			// a cut short body has no digest worth checking or recording
+			if (! hashed->digests().empty() && ! requests.abandoned(uri))
+				integrity.check(uget::url{host, port, uri, ! plain}.str(), hashed->digests());
+		}
+		monitor.dump();
+		return failed ? 1 : 0;
+	}
+
+	bool mismatch = false;
 	boost::asio::co_spawn(
 		io_context,
-		[&host, &port, &uri, &monitor] -> boost::asio::awaitable<void>
+		[&] -> boost::asio::awaitable<void>
 		{
-			try
+			auto fetch = [&] <class Client> (std::type_identity<Client>, const std::string & uri__)
+				-> boost::asio::awaitable<void>
 			{
-				co_await std::make_shared<uget::tls_client>(
+				auto client = std::make_shared<Client>(
 					host,
 					port,
-					uri,
+					uri__,
 					co_await boost::asio::this_coro::executor,
+					pool,
 					monitor
-				)->run();
-			}
-			catch (const std::exception & e)
+				);
+				client->decode(! no_compressed);
+				std::unique_ptr<uget::hash_sink> hashes;
+				if (! integrity.algorithms().empty())
+					hashes = std::make_unique<uget::hash_sink>(* sink, integrity.algorithms());
+				co_await client->run(hashes ? * hashes : * sink);
+				if (hashes)
+				{
+					auto name = output.empty() ? uget::url{host, port, uri__, ! plain}.str() : output;
+					if (! integrity.check(name, hashes->digests(), "SHA-256", expect_sha256))
+						mismatch = true;
+				}
+			};
+			// later uris on the same host reuse the kept-alive connection
+			for (const auto & uri: uris)
 			{
-				std::cerr << "\n\n\n";
-				std::cerr << "Caught std::exception network:\n" << e.what()
-					<< std::endl << std::endl;
+				try
+				{
+					if (plain)
+						co_await fetch(std::type_identity<uget::http_client>{}, uri);
+					else
+						co_await fetch(std::type_identity<uget::tls_client>{}, uri);
+				}
+				catch (const std::exception & e)
+				{
+					std::cerr << "\n\n\n";
+					std::cerr << "Caught std::exception network:\n" << e.what()
+						<< std::endl << std::endl;
+				}
 			}
+			co_await pool.shutdown();
 		},
-		boost::asio::detached
+		done
 	);
 
 	io_context.run();
+	monitor.dump();
 
-	return 0;
+	return mismatch ? 1 : 0;
 }
 catch (std::exception & e)
 {
@@ -413,4 +7052,3 @@ catch (std::exception & e)
 	std::cerr << "Caught std::exception:\n" << e.what() << std::endl << std::endl;
 	return 1;
 }
-